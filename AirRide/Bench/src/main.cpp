@@ -0,0 +1,405 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Framed control protocol; must match AirRide/Init
+#define CONTROL_VERSION 2
+#define FRAME_REQUEST 1
+#define FRAME_DATA 2
+#define FRAME_END 3
+#define CONTROL_JSON 0x1
+#define CONTROL_FAILED 0x1
+
+#define PING_ROUNDS 1000      // control round trips timed per run
+#define POLL_MS 10            // boot progress polling interval
+#define BOOT_TIMEOUT 300      // seconds before a run is abandoned
+#define MAX_DEPS 3            // after= edges per unit, to earlier units
+
+struct ControlFrame {
+    char magic[2];
+    uint8_t version;
+    uint8_t type;
+    uint16_t flags;
+    uint16_t reserved;
+    uint32_t id;
+    uint32_t length;
+};
+
+struct RunResult {
+    size_t units = 0;
+    bool ok = false;
+    double ready_s = 0;         // fork of init until boot finished
+    double spawn_rate = 0;      // units per second over ready_s
+    size_t failed = 0;
+    double ping_p50_us = 0;
+    double ping_p99_us = 0;
+    long rss_kb = 0;
+    long peak_rss_kb = 0;
+    double shutdown_s = 0;
+};
+
+static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One persistent connection to a test-mode AirRide
+class ControlClient {
+private:
+    int sock = -1;
+    uint32_t next_id = 1;
+
+    static bool read_full(int fd, void* buf, size_t len) {
+        char* p = (char*)buf;
+        while (len > 0) {
+            ssize_t n = read(fd, p, len);
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+public:
+    ~ControlClient() {
+        if (sock != -1) close(sock);
+    }
+
+    bool connect_to(const std::string& path) {
+        sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock == -1) return false;
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            close(sock);
+            sock = -1;
+            return false;
+        }
+        return true;
+    }
+
+    // Full reply of one request, or false if the connection broke
+    bool request(const std::string& cmd, std::string& reply, bool json = false) {
+        ControlFrame hdr = {{'A', 'R'}, CONTROL_VERSION, FRAME_REQUEST,
+                            (uint16_t)(json ? CONTROL_JSON : 0), 0, next_id++, (uint32_t)cmd.length()};
+        std::string frame((const char*)&hdr, sizeof(hdr));
+        frame += cmd;
+        if (write(sock, frame.data(), frame.length()) != (ssize_t)frame.length()) return false;
+
+        reply.clear();
+        std::string payload;
+        while (read_full(sock, &hdr, sizeof(hdr))) {
+            if (hdr.magic[0] != 'A' || hdr.magic[1] != 'R') return false;
+            payload.resize(hdr.length);
+            if (!read_full(sock, &payload[0], hdr.length)) return false;
+            if (hdr.type == FRAME_DATA) reply += payload;
+            else if (hdr.type == FRAME_END) return true;
+        }
+        return false;
+    }
+};
+
+class Bench {
+private:
+    std::string init_path = "airride";
+    std::string work_dir;
+    std::vector<size_t> sizes = {10, 100, 1000, 10000};
+    unsigned seed = 1;
+    bool keep = false;
+
+    static size_t count(const std::string& haystack, const std::string& needle) {
+        size_t n = 0;
+        for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1)) n++;
+        return n;
+    }
+
+    static long status_kb(pid_t pid, const std::string& field) {
+        std::ifstream f("/proc/" + std::to_string(pid) + "/status");
+        std::string line;
+        while (std::getline(f, line)) {
+            if (line.compare(0, field.size() + 1, field + ":") == 0) return std::stol(line.substr(field.size() + 1));
+        }
+        return 0;
+    }
+
+    // N units: mostly long-running sleeps, some notify and oneshot stubs,
+    // each ordered after up to MAX_DEPS random earlier units
+    void generate_units(const std::string& dir, size_t n, std::mt19937& rng) {
+        mkdir(dir.c_str(), 0755);
+        std::uniform_int_distribution<int> kind(0, 99);
+        std::uniform_int_distribution<int> deps(0, MAX_DEPS);
+        for (size_t i = 0; i < n; i++) {
+            std::string name = "bench" + std::to_string(i);
+            std::ofstream f(dir + "/" + name + ".service");
+            f << "[Service]\nname=" << name << "\n";
+            int k = kind(rng);
+            if (k < 70) {
+                f << "exec_start=/bin/sleep 3600\n";
+            } else if (k < 85) {
+                f << "type=notify\n";
+                f << "exec_start=/bin/sh -c 'echo READY=1 >&$NOTIFY_FD; exec sleep 3600'\n";
+            } else {
+                f << "type=oneshot\nexec_start=/bin/true\n";
+            }
+            f << "autostart=true\nparallel=true\n";
+
+            if (i == 0) continue;
+            std::uniform_int_distribution<size_t> earlier(0, i - 1);
+            int edges = deps(rng);
+            if (edges == 0) continue;
+            f << "[Dependencies]\nafter=";
+            for (int e = 0; e < edges; e++) f << (e ? " " : "") << "bench" << earlier(rng);
+            f << "\n";
+        }
+
+        // Holding a tty keeps the emergency shell off the console
+        std::ofstream f(dir + "/bench-console.service");
+        f << "[Service]\nname=bench-console\nexec_start=/bin/sleep 3600\ntty=/dev/null\nautostart=true\nparallel=true\n";
+    }
+
+    // Per-run group below the cgroup we run in; empty without cgroup2,
+    // and AirRide then runs the services without one
+    static std::string cgroup_for(size_t n) {
+        std::ifstream mounts("/proc/mounts");
+        std::string dev, mount, type, rest;
+        while (mounts >> dev >> mount >> type && std::getline(mounts, rest)) {
+            if (type == "cgroup2") break;
+        }
+        if (type != "cgroup2") return "";
+        std::ifstream self("/proc/self/cgroup");
+        std::string line, own;
+        while (std::getline(self, line)) {
+            if (line.compare(0, 3, "0::") == 0) own = line.substr(3);
+        }
+        if (own == "/") own.clear();
+        return mount + own + "/airride-bench-" + std::to_string(getpid()) + "-" + std::to_string(n);
+    }
+
+    // AirRide removes its groups on a clean exit; after a killed run the
+    // services are still in theirs
+    static void remove_cgroup(const std::string& path) {
+        if (path.empty()) return;
+        for (int attempt = 0; attempt < 100; attempt++) {
+            DIR* d = opendir(path.c_str());
+            if (!d) return;
+            while (struct dirent* e = readdir(d)) {
+                if (e->d_type != DT_DIR || e->d_name[0] == '.') continue;
+                std::string group = path + "/" + e->d_name;
+                std::ofstream(group + "/cgroup.kill") << "1";
+                rmdir(group.c_str());
+            }
+            closedir(d);
+            if (rmdir(path.c_str()) == 0) return;
+            usleep(POLL_MS * 1000);
+        }
+        std::cerr << "Cannot remove " << path << std::endl;
+    }
+
+    pid_t launch_init(const std::string& dir, const std::string& cgroup) {
+        pid_t pid = fork();
+        if (pid != 0) return pid;
+        int out = open((dir + "/init.log").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out != -1) {
+            dup2(out, 1);
+            dup2(out, 2);
+        }
+        setenv("AIRRIDE_SOCKET", (dir + "/airride.sock").c_str(), 1);
+        setenv("AIRRIDE_SERVICES_DIR", (dir + "/services").c_str(), 1);
+        setenv("AIRRIDE_LOG_DIR", (dir + "/log").c_str(), 1);
+        setenv("AIRRIDE_UNIT_CACHE", (dir + "/units.cache").c_str(), 1);
+        setenv("AIRRIDE_TIMER_STATE", (dir + "/timers.state").c_str(), 1);
+        if (!cgroup.empty()) setenv("AIRRIDE_CGROUP", cgroup.c_str(), 1);
+        execlp(init_path.c_str(), init_path.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+
+    bool wait_exit(pid_t pid, int timeout_sec) {
+        int64_t deadline = now_us() + (int64_t)timeout_sec * 1000000;
+        while (now_us() < deadline) {
+            if (waitpid(pid, nullptr, WNOHANG) == pid) return true;
+            usleep(POLL_MS * 1000);
+        }
+        return false;
+    }
+
+    RunResult run_one(size_t n) {
+        RunResult r;
+        r.units = n;
+        std::string dir = work_dir + "/n" + std::to_string(n);
+        mkdir(dir.c_str(), 0755);
+        std::mt19937 rng(seed);
+        generate_units(dir + "/services", n, rng);
+
+        std::string cgroup = cgroup_for(n);
+        int64_t started = now_us();
+        pid_t init = launch_init(dir, cgroup);
+        if (init == -1) return r;
+
+        ControlClient ctl;
+        while (!ctl.connect_to(dir + "/airride.sock")) {
+            bool exited = waitpid(init, nullptr, WNOHANG) == init;
+            if (exited || now_us() - started > BOOT_TIMEOUT * 1000000ll) {
+                std::cerr << "AirRide did not come up, see " << dir << "/init.log" << std::endl;
+                if (!exited) {
+                    kill(init, SIGKILL);
+                    waitpid(init, nullptr, 0);
+                }
+                remove_cgroup(cgroup);
+                return r;
+            }
+            usleep(1000);
+        }
+
+        // Boot is over once AirRide records its start-services phase
+        std::string reply;
+        bool booted = false;
+        while (now_us() - started < BOOT_TIMEOUT * 1000000ll) {
+            if (!ctl.request("analyze phases", reply)) break;
+            if (reply.find(" start-services\n") != std::string::npos) {
+                booted = true;
+                break;
+            }
+            usleep(POLL_MS * 1000);
+        }
+        int64_t ready = now_us();
+
+        if (booted) {
+            r.ok = true;
+            r.ready_s = (ready - started) / 1e6;
+            r.spawn_rate = n / r.ready_s;
+            ctl.request("list", reply, true);
+            r.failed = count(reply, "\"state\":\"failed\"");
+
+            std::vector<int64_t> rtt;
+            for (int i = 0; i < PING_ROUNDS; i++) {
+                int64_t t = now_us();
+                if (!ctl.request("ping", reply)) break;
+                rtt.push_back(now_us() - t);
+            }
+            std::sort(rtt.begin(), rtt.end());
+            if (!rtt.empty()) {
+                r.ping_p50_us = rtt[rtt.size() / 2];
+                r.ping_p99_us = rtt[rtt.size() * 99 / 100];
+            }
+            r.rss_kb = status_kb(init, "VmRSS");
+            r.peak_rss_kb = status_kb(init, "VmHWM");
+        } else {
+            std::cerr << "Boot of " << n << " units did not finish, see " << dir << "/init.log" << std::endl;
+        }
+
+        // Test mode stops every service and exits on poweroff
+        int64_t stopping = now_us();
+        ctl.request("poweroff", reply);
+        if (wait_exit(init, BOOT_TIMEOUT)) {
+            r.shutdown_s = (now_us() - stopping) / 1e6;
+        } else {
+            std::cerr << "AirRide did not exit, killing it" << std::endl;
+            kill(init, SIGKILL);
+            waitpid(init, nullptr, 0);
+            r.ok = false;
+        }
+        remove_cgroup(cgroup);
+        return r;
+    }
+
+    static void print_usage(const char* prog) {
+        std::cout << "Usage: " << prog << " [options]\n\n";
+        std::cout << "Boots synthetic unit sets under a test-mode AirRide and reports\n";
+        std::cout << "time to all ready, spawn rate, control latency and init memory.\n\n";
+        std::cout << "Options:\n";
+        std::cout << "  --init PATH          AirRide binary to run (default: airride from PATH)\n";
+        std::cout << "  --sizes N,N,...      Unit counts to benchmark (default: 10,100,1000,10000)\n";
+        std::cout << "  --seed N             Seed for unit kinds and dependency graphs (default: 1)\n";
+        std::cout << "  --dir PATH           Work directory (default: a new one under /tmp)\n";
+        std::cout << "  --keep               Keep generated units and logs afterwards\n";
+    }
+
+public:
+    int run(int argc, char* argv[]) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--init" && has_value) init_path = argv[++i];
+            else if (arg == "--seed" && has_value) seed = std::stoul(argv[++i]);
+            else if (arg == "--dir" && has_value) work_dir = argv[++i];
+            else if (arg == "--keep") keep = true;
+            else if (arg == "--sizes" && has_value) {
+                sizes.clear();
+                std::stringstream ss(argv[++i]);
+                std::string n;
+                while (std::getline(ss, n, ',')) sizes.push_back(std::stoul(n));
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+
+        if (work_dir.empty()) {
+            char tmpl[] = "/tmp/airride-bench.XXXXXX";
+            if (!mkdtemp(tmpl)) {
+                std::cerr << "Error: Cannot create work directory" << std::endl;
+                return 1;
+            }
+            work_dir = tmpl;
+        } else {
+            mkdir(work_dir.c_str(), 0755);
+        }
+
+        std::cout << std::left << std::setw(8) << "units" << std::setw(10) << "ready"
+                  << std::setw(12) << "spawn/s" << std::setw(8) << "failed"
+                  << std::setw(11) << "ping p50" << std::setw(11) << "ping p99"
+                  << std::setw(11) << "rss" << std::setw(11) << "peak rss"
+                  << "shutdown" << std::endl;
+
+        bool all_ok = true;
+        for (size_t n : sizes) {
+            RunResult r = run_one(n);
+            all_ok = all_ok && r.ok;
+            std::stringstream ready, rate, p50, p99, rss, peak, down;
+            ready << std::fixed << std::setprecision(3) << r.ready_s << "s";
+            rate << std::fixed << std::setprecision(0) << r.spawn_rate;
+            p50 << std::fixed << std::setprecision(0) << r.ping_p50_us << "us";
+            p99 << std::fixed << std::setprecision(0) << r.ping_p99_us << "us";
+            rss << std::fixed << std::setprecision(1) << r.rss_kb / 1024.0 << "M";
+            peak << std::fixed << std::setprecision(1) << r.peak_rss_kb / 1024.0 << "M";
+            down << std::fixed << std::setprecision(3) << r.shutdown_s << "s";
+            std::cout << std::left << std::setw(8) << n << std::setw(10) << (r.ok ? ready.str() : "-")
+                      << std::setw(12) << rate.str() << std::setw(8) << r.failed
+                      << std::setw(11) << p50.str() << std::setw(11) << p99.str()
+                      << std::setw(11) << rss.str() << std::setw(11) << peak.str()
+                      << down.str() << std::endl;
+        }
+
+        if (keep) {
+            std::cout << "\nUnits and logs kept in " << work_dir << std::endl;
+        } else {
+            std::string cmd = "rm -rf '" + work_dir + "'";
+            if (system(cmd.c_str()) != 0) std::cerr << "Cannot remove " << work_dir << std::endl;
+        }
+        return all_ok ? 0 : 1;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    Bench bench;
+    return bench.run(argc, argv);
+}
@@ -1,15 +1,40 @@
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <ctime>
+#include <cstdint>
+#include <cstdlib>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 #define AIRRIDE_SOCKET "/run/airride.sock"
 
+// Framed control protocol; must match AirRide/Init
+#define CONTROL_VERSION 2
+#define FRAME_REQUEST 1
+#define FRAME_DATA 2
+#define FRAME_END 3
+#define CONTROL_JSON 0x1
+#define CONTROL_FAILED 0x1
+
+struct ControlFrame {
+    char magic[2];
+    uint8_t version;
+    uint8_t type;
+    uint16_t flags;
+    uint16_t reserved;
+    uint32_t id;
+    uint32_t length;
+};
+
 class AirRideCtl {
 private:
     int sock = -1;
+    bool json = false;
+    std::string socket_path = AIRRIDE_SOCKET;
 
     bool connect_to_airride() {
         sock = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -21,7 +46,7 @@ private:
         struct sockaddr_un addr;
         memset(&addr, 0, sizeof(addr));
         addr.sun_family = AF_UNIX;
-        strncpy(addr.sun_path, AIRRIDE_SOCKET, sizeof(addr.sun_path) - 1);
+        strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
 
         if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
             std::cerr << "Error: Cannot connect to AirRide. Is it running?" << std::endl;
@@ -33,47 +58,174 @@ private:
         return true;
     }
 
-    std::string send_command(const std::string& cmd) {
+    static bool read_full(int fd, void* buf, size_t len) {
+        char* p = (char*)buf;
+        while (len > 0) {
+            ssize_t n = read(fd, p, len);
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    // Send one request and copy its reply to stdout as it arrives.
+    // Returns the exit status: 0 on success, 1 if the command failed.
+    int send_command(const std::string& cmd) {
         if (!connect_to_airride()) {
-            return "";
+            return 1;
         }
 
-        // Send command
-        if (write(sock, cmd.c_str(), cmd.length()) == -1) {
+        ControlFrame hdr = {{'A', 'R'}, CONTROL_VERSION, FRAME_REQUEST,
+                            (uint16_t)(json ? CONTROL_JSON : 0), 0, 1, (uint32_t)cmd.length()};
+        std::string request((const char*)&hdr, sizeof(hdr));
+        request += cmd;
+        if (write(sock, request.data(), request.length()) != (ssize_t)request.length()) {
             std::cerr << "Error: Failed to send command" << std::endl;
             close(sock);
-            return "";
+            return 1;
         }
 
-        // Receive response
-        char buffer[4096];
-        ssize_t n = read(sock, buffer, sizeof(buffer) - 1);
+        std::string payload;
+        while (read_full(sock, &hdr, sizeof(hdr))) {
+            if (hdr.magic[0] != 'A' || hdr.magic[1] != 'R') break;
+            payload.resize(hdr.length);
+            if (!read_full(sock, &payload[0], hdr.length)) break;
+            if (hdr.type == FRAME_DATA) {
+                std::cout.write(payload.data(), payload.size());
+                std::cout.flush();
+            } else if (hdr.type == FRAME_END) {
+                close(sock);
+                return (hdr.flags & CONTROL_FAILED) ? 1 : 0;
+            }
+        }
         close(sock);
+        std::cerr << "Error: Connection to AirRide lost" << std::endl;
+        return 1;
+    }
 
-        if (n > 0) {
-            buffer[n] = '\0';
-            return std::string(buffer);
+    // Accepts "2026-10-16 08:00[:00]", "2026-10-16", "today", "yesterday",
+    // "now", "@<epoch seconds>" and relative "-30m", "-2h", "-1d".
+    // Returns microseconds since the epoch, or -1.
+    static int64_t parse_time(const std::string& value) {
+        time_t now = time(nullptr);
+        if (value == "now") return (int64_t)now * 1000000;
+        if (value == "today" || value == "yesterday") {
+            struct tm tm;
+            localtime_r(&now, &tm);
+            tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+            if (value == "yesterday") tm.tm_mday--;
+            return (int64_t)mktime(&tm) * 1000000;
+        }
+        if (value.size() > 1 && (value[0] == '@' || value[0] == '-')) {
+            char* end;
+            errno = 0;
+            long long n = strtoll(value.c_str() + 1, &end, 10);
+            if (!isdigit((unsigned char)value[1]) || errno == ERANGE) return -1;
+            if (value[0] == '@') return *end == '\0' && n < 100000000000LL ? (int64_t)n * 1000000 : -1;
+            if (end[0] == '\0' || end[1] != '\0' || n > 1000000) return -1;
+            switch (*end) {
+                case 's': break;
+                case 'm': n *= 60; break;
+                case 'h': n *= 3600; break;
+                case 'd': n *= 86400; break;
+                default: return -1;
+            }
+            return (int64_t)(now - n) * 1000000;
         }
 
-        return "";
+        const char* formats[] = {"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"};
+        for (const char* fmt : formats) {
+            struct tm tm;
+            memset(&tm, 0, sizeof(tm));
+            const char* end = strptime(value.c_str(), fmt, &tm);
+            if (end && *end == '\0') {
+                tm.tm_isdst = -1;
+                return (int64_t)mktime(&tm) * 1000000;
+            }
+        }
+        return -1;
+    }
+
+    // `logs [service] --since T --until T --service S` reads the journal
+    int query_journal(int argc, char* argv[]) {
+        std::string request = "journal";
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if ((arg == "--since" || arg == "--until" || arg == "--service") && i + 1 < argc) {
+                std::string value = argv[++i];
+                if (arg == "--service") {
+                    request += " service=" + value;
+                    continue;
+                }
+                int64_t us = parse_time(value);
+                if (us < 0) {
+                    std::cerr << "Error: Cannot parse time '" << value << "'\n";
+                    return 1;
+                }
+                request += " " + arg.substr(2) + "=" + std::to_string(us);
+            } else if (arg[0] != '-') {
+                request += " service=" + arg;
+            } else {
+                std::cerr << "Error: Unknown option '" << arg << "'\n";
+                return 1;
+            }
+        }
+        return send_command(request);
     }
 
     void print_usage(const std::string& prog) {
-        std::cout << "Usage: " << prog << " <command> [service]\n\n";
+        std::cout << "Usage: " << prog << " [--json] [--socket PATH] <command> [service...]\n\n";
         std::cout << "Commands:\n";
-        std::cout << "  start <service>    Start a service\n";
-        std::cout << "  stop <service>     Stop a service\n";
-        std::cout << "  restart <service>  Restart a service\n";
-        std::cout << "  status <service>   Show service status\n";
-        std::cout << "  list               List all services\n";
+        std::cout << "  start <service...>   Start services\n";
+        std::cout << "  stop <service...>    Stop services\n";
+        std::cout << "  restart <service...> Restart services\n";
+        std::cout << "  status <service...>  Show service status\n";
+        std::cout << "  list                 List all services\n";
+        std::cout << "  jobs                 List queued, running and recent jobs\n";
+        std::cout << "  timers               List timer units by next elapse\n";
+        std::cout << "  wait <job...>        Wait for queued jobs to finish\n";
+        std::cout << "  ping                 Check that AirRide is answering\n";
+        std::cout << "  reload               Re-read changed unit files\n";
+        std::cout << "  poweroff | reboot | halt\n";
+        std::cout << "                       Stop all services and shut the system down\n";
+        std::cout << "  logs <service> [-f]  Show recent output, -f to follow\n";
+        std::cout << "  logs [--service S] [--since T] [--until T]\n";
+        std::cout << "                       Search the journal (T: \"2026-10-16 08:00\", today, -2h, @epoch)\n";
+        std::cout << "  analyze [view]       Boot timing: phases, blame, critical-chain or trace (Chrome JSON)\n";
+        std::cout << "\nOptions:\n";
+        std::cout << "  --json               Machine-readable output for list, status, jobs, timers and start/stop\n";
+        std::cout << "  --no-block           (after start/stop/restart) queue the jobs and print their ids\n";
+        std::cout << "  --socket PATH        Talk to the instance listening on PATH (also AIRRIDE_SOCKET)\n";
         std::cout << "\nExamples:\n";
-        std::cout << "  " << prog << " start sshd\n";
+        std::cout << "  " << prog << " start sshd network\n";
         std::cout << "  " << prog << " status network\n";
-        std::cout << "  " << prog << " list\n";
+        std::cout << "  " << prog << " --json list\n";
+        std::cout << "  " << prog << " restart --no-block network\n";
+        std::cout << "  " << prog << " logs network -f\n";
+        std::cout << "  " << prog << " logs --service network --since yesterday --until today\n";
+        std::cout << "  " << prog << " analyze trace > boot.json\n";
     }
 
 public:
     int run(int argc, char* argv[]) {
+        const char* env_socket = getenv("AIRRIDE_SOCKET");
+        if (env_socket && *env_socket) socket_path = env_socket;
+        
+        while (argc >= 2) {
+            std::string opt = argv[1];
+            int used = 1;
+            if (opt == "--json") json = true;
+            else if (opt == "--socket" && argc >= 3) {
+                socket_path = argv[2];
+                used = 2;
+            }
+            else break;
+            argv[used] = argv[0];
+            argc -= used;
+            argv += used;
+        }
+
         if (argc < 2) {
             print_usage(argv[0]);
             return 1;
@@ -81,14 +233,24 @@ public:
 
         std::string command = argv[1];
 
-        // Handle list command (no service name needed)
-        if (command == "list") {
-            std::string response = send_command("list");
-            if (!response.empty()) {
-                std::cout << response;
-                return 0;
+        // Commands without a service name
+        if (command == "list" || command == "ping" || command == "jobs" || command == "timers" ||
+            command == "reload" || command == "poweroff" || command == "reboot" || command == "halt") {
+            return send_command(command);
+        }
+
+        if (command == "analyze") {
+            std::string view = argc >= 3 ? argv[2] : "";
+            return send_command(view.empty() ? "analyze" : "analyze " + view);
+        }
+
+        if (command == "logs") {
+            for (int i = 2; i < argc; i++) {
+                std::string arg = argv[i];
+                if (arg == "--since" || arg == "--until" || arg == "--service") {
+                    return query_journal(argc, argv);
+                }
             }
-            return 1;
         }
 
         // Other commands need a service name
@@ -100,29 +262,25 @@ public:
 
         std::string service = argv[2];
 
+        if (command == "logs") {
+            bool follow = argc >= 4 && std::string(argv[3]) == "-f";
+            return send_command("logs " + service + (follow ? " -f" : ""));
+        }
+
         // Validate command
-        if (command != "start" && command != "stop" && 
-            command != "restart" && command != "status") {
+        if (command != "start" && command != "stop" && command != "restart" &&
+            command != "status" && command != "wait") {
             std::cerr << "Error: Unknown command '" << command << "'\n\n";
             print_usage(argv[0]);
             return 1;
         }
 
-        // Send command to AirRide
-        std::string full_command = command + " " + service;
-        std::string response = send_command(full_command);
-
-        if (!response.empty()) {
-            std::cout << response;
-            
-            // Check if operation was successful
-            if (response.find("FAILED") != std::string::npos) {
-                return 1;
-            }
-            return 0;
+        // Several services go out as one request
+        std::string full_command = command;
+        for (int i = 2; i < argc; i++) {
+            full_command += " " + std::string(argv[i]);
         }
-
-        return 1;
+        return send_command(full_command);
     }
 };
 
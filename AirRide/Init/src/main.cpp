@@ -1,9 +1,13 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <deque>
+#include <queue>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -11,7 +15,18 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
+#include <sys/fanotify.h>
+#include <linux/netlink.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <sys/reboot.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <cstring>
@@ -20,435 +35,6093 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
 #include <sys/sysmacros.h>
+#include <pwd.h>
+#include <grp.h>
+#include <fnmatch.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <sched.h>
+#include <climits>
+#include <cmath>
+#include <random>
+
+#ifdef AIRRIDE_ZSTD
+#include <zstd.h>
+#endif
 
 #define AIRRIDE_SOCKET "/run/airride.sock"
 #define SERVICES_DIR "/etc/airride/services"
 #define LOG_DIR "/var/log/airride"
+#define NOTIFY_FD 3          // readiness pipe, after any LISTEN_FDS
+#define LISTEN_FDS_START 3   // first passed socket (sd_listen_fds convention)
+#define SOCKET_MAX_FDS 16    // listeners passed to one service
+#define LOG_RING_SIZE (64 * 1024)   // in-memory tail kept per service
+#define LOG_FLUSH_BYTES (16 * 1024) // write to disk once this much is pending
+#define LOG_FLUSH_MS 1000           // ...or after this long
+#define JOURNAL_SEGMENT_SIZE (8 << 20)     // seal the active segment past this
+#define JOURNAL_BLOCK_SIZE (64 << 10)      // unit of indexing and compression
+#define JOURNAL_MAX_BYTES (4ull << 30)     // default cap; oldest segments dropped past it
+#define SPAWN_STACK_SIZE (64 * 1024)
+#define UNIT_CACHE "/var/lib/airride/units.cache"
+#define UNIT_CACHE_VERSION 6
+#define RELOAD_DELAY_MS 200   // let a burst of inotify events settle first
+#define TABLE_PUBLISH_MS 50   // batch window for republishing the status table
+#define PSI_STALL_US 200000     // stall per window that counts as pressure
+#define PSI_WINDOW_US 2000000   // trigger window; unprivileged PSI needs 2s multiples
+#define START_SLOT_HOLD_MS 2000 // a unit slow to settle gives its start slot back after this
+#define TIMER_STATE "/var/lib/airride/timers.state"
+#define READAHEAD_LIST "/var/lib/airride/readahead.list"
+#define READAHEAD_TAIL_MS 5000        // keep recording this long after boot
+#define READAHEAD_MAX_FILES 4096
+#define READAHEAD_MAX_BYTES (1ull << 30)  // stop prefetching past this
+#define DEVICE_RULES "/etc/airride/devices.rules"
+#define DEVICE_WAIT_SEC 30        // dev: dependencies give up after this
+#define COLDPLUG_THREADS 4
+#define UEVENT_RCVBUF (16 << 20)  // room for the coldplug burst
+#define MODPROBE_BATCH_MS 50
+#define CONSOLE_QUEUE_MAX 4096    // lines waiting for the console before we drop
+#define CONSOLE_SETTLE_MS 100     // wait for queued output before clearing the screen
+#define CONSOLE_DRAIN_MS 2000     // ...and before exit or reboot
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CGROUP_DIR CGROUP_ROOT "/airride"   // one child group per service
+
+// Where this instance keeps its state. The defaults above can be moved
+// with AIRRIDE_* environment variables or command-line flags, so that
+// test-mode instances run side by side without touching the real ones.
+// The service cgroup is the exception: it defaults to CGROUP_DIR only as
+// PID 1, and a test-mode instance runs without cgroups unless given one.
+struct Paths {
+    std::string socket = AIRRIDE_SOCKET;
+    std::string services = SERVICES_DIR;
+    std::string logs = LOG_DIR;
+    std::string cache = UNIT_CACHE;
+    std::string cgroup;
+    std::string readahead = READAHEAD_LIST;
+    std::string devices = DEVICE_RULES;
+    std::string timer_state = TIMER_STATE;
+};
+
+static Paths paths;
+static std::string start_slots_option;  // services launched at once, default: CPUs
+static std::string readahead_option = "auto";  // auto, record, replay or off
+static std::string console_option;  // quiet or verbose; "quiet" on the kernel command line
+static std::string journal_max_option;  // journal size cap, "4G"; default JOURNAL_MAX_BYTES
+
+// Flags win over the environment. Arguments we do not know are left
+// alone: as PID 1 we also receive whatever the kernel did not parse.
+static void configure(int argc, char* argv[]) {
+    struct Option {
+        const char* flag;
+        const char* env;
+        std::string* value;
+    };
+    const Option options[] = {
+        {"--socket", "AIRRIDE_SOCKET", &paths.socket},
+        {"--services", "AIRRIDE_SERVICES_DIR", &paths.services},
+        {"--log-dir", "AIRRIDE_LOG_DIR", &paths.logs},
+        {"--unit-cache", "AIRRIDE_UNIT_CACHE", &paths.cache},
+        {"--cgroup", "AIRRIDE_CGROUP", &paths.cgroup},
+        {"--start-slots", "AIRRIDE_START_SLOTS", &start_slots_option},
+        {"--readahead-list", "AIRRIDE_READAHEAD_LIST", &paths.readahead},
+        {"--device-rules", "AIRRIDE_DEVICE_RULES", &paths.devices},
+        {"--timer-state", "AIRRIDE_TIMER_STATE", &paths.timer_state},
+        {"--readahead", "AIRRIDE_READAHEAD", &readahead_option},
+        {"--console", "AIRRIDE_CONSOLE", &console_option},
+        {"--journal-max", "AIRRIDE_JOURNAL_MAX", &journal_max_option},
+    };
+    for (const auto& opt : options) {
+        const char* value = getenv(opt.env);
+        if (value && *value) *opt.value = value;
+    }
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        for (const auto& opt : options) {
+            size_t len = strlen(opt.flag);
+            if (arg == opt.flag && i + 1 < argc) *opt.value = argv[++i];
+            else if (arg.compare(0, len, opt.flag) == 0 && arg.size() > len && arg[len] == '=') *opt.value = arg.substr(len + 1);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Console output
+//
+// std::cout and std::cerr are pointed at ConsoleBufs. Each thread collects
+// its own partial line; complete lines are pushed onto a lock-free stack
+// and written out in batches by a single writer thread, so no caller ever
+// waits on a slow serial console. Past CONSOLE_QUEUE_MAX queued lines new
+// output is dropped and counted. In quiet mode only std::cerr (failures)
+// reaches the console, plus a progress line redrawn in place.
+// ---------------------------------------------------------------------------
+
+class Console {
+public:
+    enum Kind { INFO, ERROR, PROGRESS, SUMMARY };
+
+    void start() {
+        wake_fd = eventfd(0, EFD_CLOEXEC);
+        tty = isatty(STDOUT_FILENO);
+        std::cout.rdbuf(&info_buf);
+        std::cerr.rdbuf(&error_buf);
+        std::cerr.unsetf(std::ios::unitbuf);
+        // The writer starts before init blocks the signals it reads from
+        // its signalfd; with everything blocked here it can never be the
+        // thread the kernel delivers them to
+        sigset_t all, saved;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &saved);
+        std::thread([this]() { run(); }).detach();
+        pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+    }
+
+    void set_quiet(bool on) { quiet = on; }
+    bool is_quiet() const { return quiet; }
+
+    // Redraw the progress line (quiet mode on a terminal only); a summary
+    // ends it and is shown in either mode
+    void progress(const std::string& text) { push(PROGRESS, text); }
+    void summary(const std::string& text) { push(SUMMARY, text + "\n"); }
+
+    void push(Kind kind, std::string text) {
+        if (text.empty() || (kind == INFO && quiet) || (kind == PROGRESS && (!quiet || !tty))) return;
+        if (wake_fd == -1) {
+            // Not started yet: nothing to queue behind
+            write_all(kind == ERROR ? STDERR_FILENO : STDOUT_FILENO, text);
+            return;
+        }
+        if (queued.fetch_add(1) >= CONSOLE_QUEUE_MAX) {
+            queued--;
+            dropped++;
+            return;
+        }
+        Line* line = new Line{nullptr, kind, std::move(text)};
+        line->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(line->next, line, std::memory_order_release, std::memory_order_relaxed)) {}
+        if (!line->next) {
+            uint64_t one = 1;
+            if (write(wake_fd, &one, sizeof(one)) < 0) {}
+        }
+        pushed++;
+    }
+
+    // Wait up to `ms` for everything queued so far to be written
+    void drain(int ms) {
+        uint64_t target = pushed;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+        while (written < target && std::chrono::steady_clock::now() < deadline) usleep(1000);
+    }
+
+private:
+    struct Line {
+        Line* next;
+        Kind kind;
+        std::string text;
+    };
+
+    class ConsoleBuf : public std::streambuf {
+    public:
+        ConsoleBuf(Console& console, Kind kind) : console(console), kind(kind) {}
+
+    protected:
+        int overflow(int ch) override {
+            if (ch == EOF) return 0;
+            char c = ch;
+            xsputn(&c, 1);
+            return ch;
+        }
+
+        std::streamsize xsputn(const char* s, std::streamsize n) override {
+            std::string& line = pending();
+            line.append(s, n);
+            if (memchr(s, '\n', n)) {
+                size_t end = line.rfind('\n');
+                console.push(kind, line.substr(0, end + 1));
+                line.erase(0, end + 1);
+            }
+            return n;
+        }
+
+        int sync() override {
+            std::string& line = pending();
+            console.push(kind, std::move(line));
+            line.clear();
+            return 0;
+        }
+
+    private:
+        std::string& pending() {
+            thread_local std::string lines[2];
+            return lines[kind == ERROR];
+        }
+
+        Console& console;
+        Kind kind;
+    };
+
+    static void write_all(int fd, const std::string& data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = write(fd, data.data() + done, data.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            done += n;
+        }
+    }
+
+    void run() {
+        std::string progress_text;  // the line currently drawn, if any
+        while (true) {
+            uint64_t count;
+            if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EINTR) return;
+            Line* batch;
+            while ((batch = head.exchange(nullptr, std::memory_order_acquire)) != nullptr) {
+                // Newest first on the stack; put it back in order
+                Line* ordered = nullptr;
+                while (batch) {
+                    Line* next = batch->next;
+                    batch->next = ordered;
+                    ordered = batch;
+                    batch = next;
+                }
+
+                // Consecutive lines for the same fd go out in one write
+                std::string out;
+                int out_fd = STDOUT_FILENO;
+                size_t lines = 0;
+                auto emit = [&](int fd, const std::string& text) {
+                    if (fd != out_fd && !out.empty()) {
+                        write_all(out_fd, out);
+                        out.clear();
+                    }
+                    out_fd = fd;
+                    out += text;
+                };
+                for (Line* line = ordered; line;) {
+                    int fd = line->kind == ERROR ? STDERR_FILENO : STDOUT_FILENO;
+                    if (line->kind == PROGRESS) {
+                        emit(fd, "\r\033[K" + line->text);
+                        progress_text = line->text;
+                    } else {
+                        if (!progress_text.empty()) emit(STDOUT_FILENO, "\r\033[K");
+                        emit(fd, line->text);
+                        if (line->kind == SUMMARY) progress_text.clear();
+                        else if (!progress_text.empty()) emit(STDOUT_FILENO, progress_text);
+                    }
+                    Line* next = line->next;
+                    delete line;
+                    line = next;
+                    lines++;
+                }
+                size_t lost = dropped.exchange(0);
+                if (lost) emit(STDERR_FILENO, "[AirRide] " + std::to_string(lost) + " console lines dropped\n");
+                if (!out.empty()) write_all(out_fd, out);
+                queued -= lines;
+                written += lines;
+            }
+        }
+    }
+
+    ConsoleBuf info_buf{*this, INFO};
+    ConsoleBuf error_buf{*this, ERROR};
+    std::atomic<Line*> head{nullptr};
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> dropped{0};
+    std::atomic<uint64_t> pushed{0};
+    std::atomic<uint64_t> written{0};
+    std::atomic<bool> quiet{false};
+    int wake_fd = -1;
+    bool tty = false;
+};
+
+static Console console;
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define ATTR_UNSET INT_MIN   // nice / oom_score_adjust left as inherited
+
+enum class ServiceState { STOPPED, STARTING, RUNNING, STOPPING, FAILED };
+enum class ServiceType { SIMPLE, FORKING, ONESHOT, NOTIFY };
+
+// Monotonic timestamps (CLOCK_MONOTONIC, microseconds) of a unit's most
+// recent activation; 0 means the transition has not happened
+struct ServiceTimeline {
+    int64_t queued = 0;       // pulled into a start transaction
+    int64_t deps_ready = 0;   // all predecessors settled
+    int64_t forked = 0;
+    int64_t exec = 0;         // execvp() succeeded
+    int64_t ready = 0;        // RUNNING, or oneshot finished successfully
+    int64_t exited = 0;
+    std::string waited_on;    // predecessor that settled last
+};
+
+struct BootPhase {
+    std::string name;
+    int64_t start = 0;
+    int64_t end = 0;
+};
+
+static int pidfd_open(pid_t pid) {
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+static int pidfd_send_signal(int pidfd, int sig) {
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, nullptr, 0);
+}
+
+// Wait up to timeout_ms for the process behind a pidfd to exit
+static bool pidfd_wait_exit(int pidfd, int timeout_ms) {
+    struct pollfd pfd = {pidfd, POLLIN, 0};
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        int r = poll(&pfd, 1, left > 0 ? (int)left : 0);
+        if (r > 0) return true;
+        if (r == 0 || errno != EINTR) return false;
+    }
+}
+
+// The whole of `value` as an int; `out` is left alone on junk or overflow
+static bool parse_int(const std::string& value, int& out, int base = 10) {
+    char* end;
+    errno = 0;
+    long n = strtol(value.c_str(), &end, base);
+    if (value.empty() || *end != '\0' || errno == ERANGE || n < INT_MIN || n > INT_MAX) return false;
+    out = (int)n;
+    return true;
+}
+
+// "512", "64K", "10M", "1G" -> bytes; false on anything else
+static bool parse_size(const std::string& value, size_t& out) {
+    if (value.empty() || !isdigit((unsigned char)value[0])) return false;
+    char* end;
+    errno = 0;
+    unsigned long long n = strtoull(value.c_str(), &end, 10);
+    int shift = 0;
+    switch (toupper(*end)) {
+        case 'K': shift = 10; end++; break;
+        case 'M': shift = 20; end++; break;
+        case 'G': shift = 30; end++; break;
+    }
+    if (*end != '\0' || errno == ERANGE || n > (SIZE_MAX >> shift)) return false;
+    out = (size_t)n << shift;
+    return true;
+}
+
+// "30", "30s", "15m", "12h", "7d" -> seconds; false on anything else
+static bool parse_duration(const std::string& value, int& out) {
+    if (value.empty() || !isdigit((unsigned char)value[0])) return false;
+    char* end;
+    errno = 0;
+    long long n = strtoll(value.c_str(), &end, 10);
+    int scale = 1;
+    switch (*end) {
+        case 's': end++; break;
+        case 'm': scale = 60; end++; break;
+        case 'h': scale = 3600; end++; break;
+        case 'd': scale = 86400; end++; break;
+    }
+    if (*end != '\0' || errno == ERANGE || n > INT_MAX / scale) return false;
+    out = (int)n * scale;
+    return true;
+}
+
+// "0-3 6", "0,2,4-7" -> sorted CPU numbers
+static bool parse_cpu_list(const std::string& value, std::vector<int>& cpus) {
+    std::string list = value;
+    std::replace(list.begin(), list.end(), ',', ' ');
+    std::istringstream ss(list);
+    std::string range;
+    std::set<int> seen;
+    while (ss >> range) {
+        size_t dash = range.find('-');
+        int first, last;
+        if (!parse_int(range.substr(0, dash), first)) return false;
+        if (dash == std::string::npos) last = first;
+        else if (!parse_int(range.substr(dash + 1), last)) return false;
+        if (first < 0 || last < first || last >= CPU_SETSIZE) return false;
+        for (int cpu = first; cpu <= last; cpu++) seen.insert(cpu);
+    }
+    cpus.assign(seen.begin(), seen.end());
+    return !cpus.empty();
+}
+
+// "0 2 3 4 5 9" -> "0,2-5,9"
+static std::string format_cpu_list(const std::vector<int>& cpus) {
+    std::string out;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+        if (!out.empty()) out += ",";
+        out += std::to_string(cpus[i]);
+        if (j > i) out += "-" + std::to_string(cpus[j]);
+        i = j + 1;
+    }
+    return out;
+}
+
+// Shell-style word splitting for exec_start and environment: whitespace
+// separates words, '...' is literal, "..." allows \" \\ \$ and $VAR,
+// a backslash elsewhere escapes the next character. $VAR and ${VAR} are
+// expanded from AirRide's own environment; unset variables are empty.
+static bool split_command(const std::string& line, std::vector<std::string>& words, std::string& error) {
+    std::string word;
+    bool in_word = false;
+    char quote = 0;
+    
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quote == '\'') {
+            if (c == '\'') quote = 0;
+            else word += c;
+            continue;
+        }
+        if (c == '\\') {
+            if (++i == line.size()) {
+                error = "trailing backslash";
+                return false;
+            }
+            char next = line[i];
+            if (quote == '"' && next != '"' && next != '\\' && next != '$') word += c;
+            word += next;
+            in_word = true;
+        } else if (c == '$' && i + 1 < line.size() &&
+                   (line[i + 1] == '{' || line[i + 1] == '_' || isalpha((unsigned char)line[i + 1]))) {
+            std::string var;
+            if (line[i + 1] == '{') {
+                size_t end = line.find('}', i + 2);
+                if (end == std::string::npos) {
+                    error = "unterminated ${";
+                    return false;
+                }
+                var = line.substr(i + 2, end - i - 2);
+                i = end;
+            } else {
+                size_t end = i + 1;
+                while (end < line.size() && (line[end] == '_' || isalnum((unsigned char)line[end]))) end++;
+                var = line.substr(i + 1, end - i - 1);
+                i = end - 1;
+            }
+            const char* value = getenv(var.c_str());
+            if (value) word += value;
+            // An unquoted expansion to nothing does not make a word
+            if (value && *value) in_word = true;
+        } else if (quote == '"') {
+            if (c == '"') quote = 0;
+            else word += c;
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+            in_word = true;
+        } else if (c == ' ' || c == '\t') {
+            if (in_word) words.push_back(word);
+            word.clear();
+            in_word = false;
+        } else {
+            word += c;
+            in_word = true;
+        }
+    }
+    if (quote) {
+        error = std::string("unterminated ") + quote;
+        return false;
+    }
+    if (in_word) words.push_back(word);
+    return true;
+}
+
+// Template units are files named "<name>@.service"; "<name>@<instance>"
+// is created from one on demand. Returns "<name>@", or empty when `unit`
+// is not an instance.
+static std::string template_of(const std::string& unit) {
+    size_t at = unit.find('@');
+    if (at == std::string::npos || at + 1 == unit.size()) return "";
+    return unit.substr(0, at + 1);
+}
+
+// %i is the instance, %% a literal %
+static std::string expand_instance(const std::string& text, const std::string& instance) {
+    std::string out;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '%' && i + 1 < text.size() && (text[i + 1] == 'i' || text[i + 1] == '%')) {
+            out += text[++i] == 'i' ? instance : "%";
+        } else {
+            out += text[i];
+        }
+    }
+    return out;
+}
+
+// "worker@{1..32}" and "getty@{tty1,ttyS0}" as bash would expand them,
+// for shells (busybox ash) that do not; one brace group
+static std::vector<std::string> expand_braces(const std::string& word) {
+    size_t open = word.find('{');
+    size_t close = open == std::string::npos ? open : word.find('}', open);
+    if (close == std::string::npos) return {word};
+    std::string prefix = word.substr(0, open), suffix = word.substr(close + 1);
+    std::string body = word.substr(open + 1, close - open - 1);
+
+    std::vector<std::string> out;
+    size_t dots = body.find("..");
+    if (dots != std::string::npos && body.find(',') == std::string::npos) {
+        char* end;
+        long from = strtol(body.c_str(), &end, 10);
+        bool ok = end == body.c_str() + dots;
+        long to = strtol(body.c_str() + dots + 2, &end, 10);
+        ok = ok && *end == '\0' && dots > 0 && labs(to - from) < 65536;
+        if (!ok) return {word};
+        for (long n = from;; n += from <= to ? 1 : -1) {
+            out.push_back(prefix + std::to_string(n) + suffix);
+            if (n == to) break;
+        }
+        return out;
+    }
+    if (body.find(',') == std::string::npos) return {word};
+    std::istringstream items(body);
+    std::string item;
+    while (std::getline(items, item, ',')) out.push_back(prefix + item + suffix);
+    return out;
+}
+
+// Per-service scheduling attributes, applied by the child just before exec
+struct ExecAttributes {
+    std::vector<int> cpu_affinity;   // empty = inherit
+    int nice = ATTR_UNSET;
+    int sched_policy = -1;           // SCHED_*, -1 = inherit
+    int sched_priority = 0;          // 1-99 for fifo/rr
+    int io_class = 0;                // IOPRIO_CLASS_*, 0 = inherit
+    int io_priority = 4;             // 0 (highest) - 7
+    int oom_score_adjust = ATTR_UNSET;
+    long timer_slack = 0;            // ns, 0 = inherit
+};
+
+// Everything the launcher child needs, prepared by the parent. The child
+// shares our memory until it execs, so it only makes raw system calls.
+struct SpawnRequest {
+    char* const* argv = nullptr;
+    char* const* envp = nullptr;
+    const char* tty = nullptr;  // controlling terminal, or none
+    int null_fd = -1;           // stdin of background services
+    int out_fd = -1;            // stdout/stderr of background services
+    int notify_fd = -1;         // moved to NOTIFY_FD
+    int cgroup_fd = -1;         // cgroup.procs of the service group
+    int listen_fds[SOCKET_MAX_FDS];
+    int listen_count = 0;
+    char listen_pid[32] = "LISTEN_PID=";  // the child appends its own pid
+    const ExecAttributes* attrs = nullptr;
+    char oom_score_adj[16] = "";  // formatted by the parent
+    const char* failed_step = nullptr;  // attribute the child could not apply
+    int exec_errno = 0;         // set by the child when exec fails
+};
+
+// In the child: apply scheduling attributes. False with errno set and
+// req->failed_step naming the attribute that could not be applied.
+static bool apply_attributes(SpawnRequest* req) {
+    const ExecAttributes& a = *req->attrs;
+    if (!a.cpu_affinity.empty()) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu : a.cpu_affinity) CPU_SET(cpu, &cpus);
+        req->failed_step = "cpu_affinity";
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) return false;
+    }
+    if (a.sched_policy != -1) {
+        struct sched_param param = {};
+        param.sched_priority = a.sched_priority;
+        req->failed_step = "sched_policy";
+        if (sched_setscheduler(0, a.sched_policy, &param) == -1) return false;
+    }
+    if (a.nice != ATTR_UNSET) {
+        req->failed_step = "nice";
+        if (setpriority(PRIO_PROCESS, 0, a.nice) == -1) return false;
+    }
+    if (a.io_class != 0) {
+        req->failed_step = "io_class";
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                    a.io_class << IOPRIO_CLASS_SHIFT | a.io_priority) == -1) return false;
+    }
+    if (req->oom_score_adj[0]) {
+        req->failed_step = "oom_score_adjust";
+        int fd = open("/proc/self/oom_score_adj", O_WRONLY | O_CLOEXEC);
+        if (fd == -1) return false;
+        ssize_t len = strlen(req->oom_score_adj);
+        bool ok = write(fd, req->oom_score_adj, len) == len;
+        close(fd);
+        if (!ok) return false;
+    }
+    if (a.timer_slack > 0) {
+        req->failed_step = "timer_slack";
+        if (prctl(PR_SET_TIMERSLACK, a.timer_slack, 0, 0, 0) == -1) return false;
+    }
+    req->failed_step = nullptr;
+    return true;
+}
+
+static int spawn_child(void* arg) {
+    SpawnRequest* req = (SpawnRequest*)arg;
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, nullptr);
+    setsid();
+    
+    // Join the service cgroup before anything can fork off it
+    if (req->cgroup_fd != -1 && write(req->cgroup_fd, "0", 1) != 1) {}
+    
+    if (req->tty) {
+        int fd = open(req->tty, O_RDWR | O_NOCTTY);
+        if (fd >= 0) {
+            dup2(fd, 0);
+            dup2(fd, 1);
+            dup2(fd, 2);
+            if (fd > 2) close(fd);
+            ioctl(0, TIOCSCTTY, 1);
+        }
+    } else {
+        int out = req->out_fd != -1 ? req->out_fd : req->null_fd;
+        if (req->null_fd != -1) dup2(req->null_fd, 0);
+        if (out != -1) {
+            dup2(out, 1);
+            dup2(out, 2);
+        }
+    }
+    
+    // Listeners go to 3, 4, ... and the readiness pipe right after them,
+    // a low fd that shells such as dash can still redirect to. Sources are
+    // parked above that range first so no dup2 overwrites one still needed.
+    int base = LISTEN_FDS_START + req->listen_count + 1;
+    for (int i = 0; i < req->listen_count; i++) {
+        req->listen_fds[i] = fcntl(req->listen_fds[i], F_DUPFD_CLOEXEC, base);
+    }
+    int notify = req->notify_fd != -1 ? fcntl(req->notify_fd, F_DUPFD_CLOEXEC, base) : -1;
+    for (int i = 0; i < req->listen_count; i++) dup2(req->listen_fds[i], LISTEN_FDS_START + i);
+    if (notify != -1) dup2(notify, NOTIFY_FD + req->listen_count);
+    
+    if (req->listen_count > 0) {
+        char digits[16];
+        int n = 0;
+        for (pid_t pid = getpid(); pid > 0; pid /= 10) digits[n++] = '0' + pid % 10;
+        char* p = req->listen_pid + strlen(req->listen_pid);
+        while (n > 0) *p++ = digits[--n];
+        *p = '\0';
+    }
+    
+    if (req->attrs && !apply_attributes(req)) {
+        req->exec_errno = errno;
+        _exit(127);
+    }
+    
+    execvpe(req->argv[0], req->argv, req->envp);
+    req->exec_errno = errno;
+    _exit(127);
+}
+
+// vfork-style launch: no page tables are copied, and we resume only once
+// the child has exec'd or failed to. Returns the pid or -1.
+static pid_t spawn_process(SpawnRequest& req) {
+    std::unique_ptr<char[]> stack(new char[SPAWN_STACK_SIZE]);
+    return clone(spawn_child, stack.get() + SPAWN_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, &req);
+}
+
+// Whole small files such as cgroup knobs; false/empty on any error
+static bool write_file(const std::string& path, const std::string& value) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+    bool ok = write(fd, value.data(), value.size()) == (ssize_t)value.size();
+    close(fd);
+    return ok;
+}
+
+static std::string read_file(const std::string& path) {
+    std::ifstream f(path);
+    std::stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+static std::string format_bytes(uint64_t n) {
+    const char* units = "BKMGT";
+    double v = n;
+    int u = 0;
+    while (v >= 1024 && u < 4) {
+        v /= 1024;
+        u++;
+    }
+    char buf[32];
+    if (u == 0) snprintf(buf, sizeof(buf), "%lluB", (unsigned long long)n);
+    else snprintf(buf, sizeof(buf), "%.1f%c", v, units[u]);
+    return buf;
+}
+
+static int64_t realtime_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+class ControlConnection;
+
+// Fixed-capacity byte ring holding the most recent output of a service
+class LogRing {
+private:
+    std::vector<char> buf = std::vector<char>(LOG_RING_SIZE);
+    size_t start = 0;
+    size_t len = 0;
+
+public:
+    void append(const char* data, size_t n) {
+        if (n >= buf.size()) {
+            data += n - buf.size();
+            n = buf.size();
+        }
+        size_t end = (start + len) % buf.size();
+        size_t first = std::min(n, buf.size() - end);
+        memcpy(&buf[end], data, first);
+        memcpy(&buf[0], data + first, n - first);
+        
+        len += n;
+        if (len > buf.size()) {
+            start = (start + len - buf.size()) % buf.size();
+            len = buf.size();
+        }
+    }
+
+    std::string contents() const {
+        std::string out;
+        size_t first = std::min(len, buf.size() - start);
+        out.append(&buf[start], first);
+        out.append(&buf[0], len - first);
+        return out;
+    }
+};
+
+// Per-service log state, owned by the event loop thread
+struct LogStream {
+    LogRing ring;
+    std::string pending;       // batched bytes not yet on disk
+    int file_fd = -1;
+    size_t file_size = 0;
+    int64_t opened_at = 0;     // monotonic_us() of open or last rotation
+    bool flush_armed = false;
+    std::vector<std::pair<std::shared_ptr<ControlConnection>, uint32_t>> followers;  // `logs -f` requests
+    size_t max_size = 0;
+    int max_files = 0;
+    int max_age = 0;
+};
+
+// ---------------------------------------------------------------------------
+// Journal: append-only binary log of every service's output.
+//
+// The journal directory holds numbered segments. The active segment
+// <seq>.jnl is plain records behind a header. Once it passes
+// JOURNAL_SEGMENT_SIZE it is sealed: records are grouped into blocks
+// (zstd-compressed one frame per block when built with AIRRIDE_ZSTD) and
+// an index is appended with:
+//   - the min/max timestamp of every block (sparse time index)
+//   - for each service, the blocks that contain its records
+// A query reads the segment headers, skips segments and blocks outside
+// its time range or without its service, and only scans what is left.
+// Sealing runs on its own thread, one segment at a time; until a segment
+// is sealed, queries read it like the active one. Past --journal-max
+// (JOURNAL_MAX_BYTES by default) the oldest segments are dropped.
+// All structures are in native byte order; the journal never leaves the
+// machine that wrote it.
+// ---------------------------------------------------------------------------
+
+#define JOURNAL_MAGIC "ARJNL\0\0\1"
+#define JOURNAL_SEALED 0x1
+#define JOURNAL_ZSTD 0x2
+#define JOURNAL_NAME_ENTRY 0x8000  // record flag: payload is a service name
+
+struct JournalHeader {
+    char magic[8];
+    uint32_t flags;
+    uint32_t reserved;
+    int64_t first_ts;       // CLOCK_REALTIME microseconds
+    int64_t last_ts;
+    uint64_t records;
+    uint64_t index_offset;  // sealed segments only
+    uint64_t index_size;
+    uint64_t pad;
+};
+static_assert(sizeof(JournalHeader) == 64, "journal header layout");
+
+struct JournalRecord {
+    int64_t ts;
+    int32_t pid;
+    uint16_t service;       // segment-local service id
+    uint16_t flags;
+    uint32_t length;        // message bytes following the header
+    uint32_t reserved;
+};
+static_assert(sizeof(JournalRecord) == 24, "journal record layout");
+
+struct JournalBlock {
+    int64_t first_ts;
+    int64_t last_ts;
+    uint64_t offset;        // position of the stored block in the file
+    uint32_t stored_len;    // bytes on disk (compressed when JOURNAL_ZSTD)
+    uint32_t raw_len;       // bytes of records
+};
+static_assert(sizeof(JournalBlock) == 32, "journal block layout");
+
+// In-memory index of one segment
+struct JournalIndex {
+    std::vector<JournalBlock> blocks;
+    std::vector<std::string> services;               // id -> name
+    std::vector<std::vector<uint32_t>> service_blocks;  // id -> block numbers
+    uint32_t flags = 0;
+
+    int service_id(const std::string& name) const {
+        for (size_t i = 0; i < services.size(); i++) {
+            if (services[i] == name) return (int)i;
+        }
+        return -1;
+    }
+
+    std::string serialize() const {
+        std::string out;
+        auto put = [&out](const void* p, size_t n) { out.append((const char*)p, n); };
+        uint32_t count = services.size();
+        put(&count, 4);
+        for (size_t i = 0; i < services.size(); i++) {
+            uint16_t len = services[i].size();
+            put(&len, 2);
+            put(services[i].data(), len);
+            uint32_t n = service_blocks[i].size();
+            put(&n, 4);
+            put(service_blocks[i].data(), n * 4);
+        }
+        count = blocks.size();
+        put(&count, 4);
+        put(blocks.data(), blocks.size() * sizeof(JournalBlock));
+        return out;
+    }
+
+    bool parse(const std::string& in) {
+        size_t pos = 0;
+        auto get = [&](void* p, size_t n) {
+            if (pos + n > in.size()) return false;
+            memcpy(p, in.data() + pos, n);
+            pos += n;
+            return true;
+        };
+        uint32_t count;
+        if (!get(&count, 4)) return false;
+        for (uint32_t i = 0; i < count; i++) {
+            uint16_t len;
+            uint32_t n;
+            std::string name;
+            if (!get(&len, 2)) return false;
+            name.resize(len);
+            if (!get(&name[0], len) || !get(&n, 4)) return false;
+            std::vector<uint32_t> ids(n);
+            if (!get(ids.data(), n * 4)) return false;
+            services.push_back(name);
+            service_blocks.push_back(ids);
+        }
+        if (!get(&count, 4)) return false;
+        blocks.resize(count);
+        return get(blocks.data(), count * sizeof(JournalBlock));
+    }
+};
+
+struct JournalQuery {
+    int64_t since = 0;
+    int64_t until = INT64_MAX;
+    std::string service;
+};
+
+class Journal {
+public:
+    // An unsealed segment with the index that only exists in memory
+    struct Segment {
+        uint64_t seq = 0;
+        int fd = -1;
+        JournalHeader header;
+        JournalIndex index;
+        uint64_t file_size = 0;
+    };
+
+private:
+    std::string dir;
+    uint64_t max_bytes = JOURNAL_MAX_BYTES;
+    uint64_t seq = 0;
+    int fd = -1;                 // active segment
+    JournalHeader header;
+    JournalIndex index;
+    uint64_t file_size = 0;      // flushed bytes of the active segment
+    std::string pending;         // records not yet written
+
+    std::mutex seal_mutex;
+    std::condition_variable sealed_cv;
+    std::deque<Segment> sealing;  // full segments, oldest (being sealed) first
+
+    std::string segment_path(uint64_t n, bool compressed) const {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.jnl", (unsigned long long)n);
+        return dir + "/" + name + (compressed ? ".zst" : "");
+    }
+
+    // Segments on disk, oldest first: (seq, path)
+    std::vector<std::pair<uint64_t, std::string>> list_segments() const {
+        std::vector<std::pair<uint64_t, std::string>> out;
+        DIR* d = opendir(dir.c_str());
+        if (!d) return out;
+        struct dirent* entry;
+        while ((entry = readdir(d)) != nullptr) {
+            std::string fname = entry->d_name;
+            bool plain = fname.size() == 20 && fname.substr(16) == ".jnl";
+            bool zst = fname.size() == 24 && fname.substr(16) == ".jnl.zst";
+            if (!plain && !zst) continue;
+            // strtoull alone would take "0x", "+" or blanks in front
+            if (!std::all_of(fname.begin(), fname.begin() + 16, [](char c) { return isxdigit((unsigned char)c); })) continue;
+            out.push_back({strtoull(fname.substr(0, 16).c_str(), nullptr, 16), dir + "/" + fname});
+        }
+        closedir(d);
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+    void index_record(JournalIndex& idx, const JournalRecord& rec, uint64_t offset) {
+        size_t size = sizeof(rec) + rec.length;
+        if (idx.blocks.empty() || idx.blocks.back().raw_len + size > JOURNAL_BLOCK_SIZE) {
+            idx.blocks.push_back({rec.ts, rec.ts, offset, 0, 0});
+        }
+        JournalBlock& block = idx.blocks.back();
+        block.first_ts = std::min(block.first_ts, rec.ts);
+        block.last_ts = std::max(block.last_ts, rec.ts);
+        block.raw_len += size;
+        block.stored_len = block.raw_len;
+        
+        auto& ids = idx.service_blocks[rec.service];
+        uint32_t block_no = idx.blocks.size() - 1;
+        if (ids.empty() || ids.back() != block_no) ids.push_back(block_no);
+    }
+
+    bool open_active() {
+        mkdir(dir.c_str(), 0755);
+        fd = ::open(segment_path(seq, false).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) return false;
+        
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, JOURNAL_MAGIC, 8);
+        header.first_ts = INT64_MAX;
+        header.last_ts = 0;
+        index = JournalIndex();
+        file_size = sizeof(header);
+        return pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+    }
+
+    // Rebuild the index of an unsealed segment left by a crash or reboot,
+    // dropping a torn trailing record, then seal it
+    void recover(uint64_t n, const std::string& path) {
+        int rfd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (rfd == -1) return;
+        
+        JournalHeader hdr;
+        if (pread(rfd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || memcmp(hdr.magic, JOURNAL_MAGIC, 8) != 0) {
+            close(rfd);
+            unlink(path.c_str());
+            return;
+        }
+        if (hdr.flags & JOURNAL_SEALED) {
+            close(rfd);
+            return;
+        }
+
+        fd = rfd;
+        seq = n;
+        header = hdr;
+        header.first_ts = INT64_MAX;
+        header.last_ts = 0;
+        header.records = 0;
+        index = JournalIndex();
+        
+        // Each service's first record in a segment is a name entry, so the
+        // records alone are enough to rebuild the name table
+        uint64_t offset = sizeof(header);
+        struct stat st;
+        fstat(fd, &st);
+        JournalRecord rec;
+        std::string names;
+        while (offset + sizeof(rec) <= (uint64_t)st.st_size &&
+               pread(fd, &rec, sizeof(rec), offset) == sizeof(rec)) {
+            if (offset + sizeof(rec) + rec.length > (uint64_t)st.st_size) break;
+            if (rec.flags & JOURNAL_NAME_ENTRY) {
+                // Name table entry: service id -> name
+                std::string name(rec.length, '\0');
+                if (pread(fd, &name[0], rec.length, offset + sizeof(rec)) != (ssize_t)rec.length) break;
+                if (index.services.size() <= rec.service) {
+                    index.services.resize(rec.service + 1);
+                    index.service_blocks.resize(rec.service + 1);
+                }
+                index.services[rec.service] = name;
+            } else if (rec.service < index.services.size()) {
+                header.first_ts = std::min(header.first_ts, rec.ts);
+                header.last_ts = std::max(header.last_ts, rec.ts);
+                header.records++;
+            } else {
+                break;
+            }
+            index_record(index, rec, offset);
+            offset += sizeof(rec) + rec.length;
+        }
+        if (header.records == 0) {
+            close(fd);
+            fd = -1;
+            unlink(path.c_str());
+            return;
+        }
+        ftruncate(fd, offset);
+        file_size = offset;
+        Segment seg = detach_active();
+        seal_now(seg);
+    }
+
+    // The active segment's state, leaving no active segment
+    Segment detach_active() {
+        Segment seg;
+        seg.seq = seq;
+        seg.fd = fd;
+        seg.header = header;
+        seg.index = std::move(index);
+        seg.file_size = file_size;
+        index = JournalIndex();
+        fd = -1;
+        return seg;
+    }
+
+    // Write the sealed form of `seg`: compressed into a temporary file
+    // (`tmp`) or, without zstd, index and header in place (`tmp` empty).
+    // A failed read or write abandons the compressed copy and falls back
+    // to sealing in place; false if even that failed, leaving the plain
+    // segment as it was for the next boot to recover.
+    bool seal(Segment& seg, std::string& tmp) const {
+        tmp.clear();
+#ifdef AIRRIDE_ZSTD
+        tmp = segment_path(seg.seq, true) + ".tmp";
+        int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = out != -1;
+        JournalIndex packed_index = seg.index;
+        JournalHeader packed_hdr = seg.header;
+        uint64_t offset = sizeof(packed_hdr);
+        std::string raw, packed;
+        for (auto& block : packed_index.blocks) {
+            if (!ok) break;
+            raw.resize(block.raw_len);
+            ok = pread(seg.fd, &raw[0], block.raw_len, block.offset) == (ssize_t)block.raw_len;
+            if (!ok) break;
+            packed.resize(ZSTD_compressBound(block.raw_len));
+            size_t n = ZSTD_compress(&packed[0], packed.size(), raw.data(), raw.size(), 3);
+            if (ZSTD_isError(n)) {
+                n = raw.size();
+                packed = raw;
+            }
+            ok = pwrite(out, packed.data(), n, offset) == (ssize_t)n;
+            block.offset = offset;
+            block.stored_len = n;
+            offset += n;
+        }
+        if (ok) {
+            std::string idx = packed_index.serialize();
+            packed_hdr.flags = JOURNAL_SEALED | JOURNAL_ZSTD;
+            packed_hdr.index_offset = offset;
+            packed_hdr.index_size = idx.size();
+            ok = pwrite(out, idx.data(), idx.size(), offset) == (ssize_t)idx.size() &&
+                 pwrite(out, &packed_hdr, sizeof(packed_hdr), 0) == sizeof(packed_hdr) && fsync(out) == 0;
+        }
+        if (out != -1) close(out);
+        if (ok) {
+            seg.index = std::move(packed_index);
+            seg.header = packed_hdr;
+            seg.file_size = offset;
+            return true;
+        }
+        unlink(tmp.c_str());
+        tmp.clear();
+#endif
+
+        // In place: the index goes after the records, then the header
+        // marks the segment sealed
+        std::string idx = seg.index.serialize();
+        JournalHeader hdr = seg.header;
+        hdr.flags = JOURNAL_SEALED;
+        hdr.index_offset = seg.file_size;
+        hdr.index_size = idx.size();
+        if (pwrite(seg.fd, idx.data(), idx.size(), seg.file_size) != (ssize_t)idx.size() ||
+            pwrite(seg.fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+            if (ftruncate(seg.fd, seg.file_size) == -1) {}
+            return false;
+        }
+        fsync(seg.fd);
+        seg.header = hdr;
+        return true;
+    }
+
+    // Seal on the calling thread, for recovery at startup
+    void seal_now(Segment& seg) const {
+        std::string tmp;
+        if (seal(seg, tmp)) finish_seal(seg, tmp);
+        else abandon_seal(seg);
+    }
+
+    void abandon_seal(Segment& seg) const {
+        std::cerr << "[AirRide] Cannot seal journal segment " << segment_path(seg.seq, false)
+                  << ": " << strerror(errno) << std::endl;
+        close(seg.fd);
+        seg.fd = -1;
+    }
+
+    // Put the sealed form in place of the plain segment
+    void finish_seal(Segment& seg, const std::string& tmp) const {
+        if (!tmp.empty()) {
+            rename(tmp.c_str(), segment_path(seg.seq, true).c_str());
+            unlink(segment_path(seg.seq, false).c_str());
+        }
+        close(seg.fd);
+        seg.fd = -1;
+    }
+
+    // Sealing thread: works through the queue, then trims the journal
+    void run_sealer() {
+        std::unique_lock<std::mutex> lock(seal_mutex);
+        while (!sealing.empty()) {
+            // Work on a copy: queries keep reading the queued original
+            Segment seg = sealing.front();
+            lock.unlock();
+            std::string tmp;
+            bool ok = seal(seg, tmp);
+            lock.lock();
+            if (ok) finish_seal(seg, tmp);
+            else abandon_seal(seg);
+            sealing.pop_front();
+        }
+        lock.unlock();
+        enforce_retention();
+        lock.lock();
+        sealed_cv.notify_all();
+    }
+
+public:
+    bool open(const std::string& journal_dir, uint64_t cap) {
+        dir = journal_dir;
+        max_bytes = cap;
+        mkdir(dir.c_str(), 0755);
+        // Half-written output of a seal cut short; the plain segment
+        // it came from is still there and gets sealed again below
+        if (DIR* d = opendir(dir.c_str())) {
+            struct dirent* entry;
+            while ((entry = readdir(d)) != nullptr) {
+                std::string fname = entry->d_name;
+                if (fname.size() > 4 && fname.substr(fname.size() - 4) == ".tmp") {
+                    unlink((dir + "/" + fname).c_str());
+                }
+            }
+            closedir(d);
+        }
+        for (const auto& [n, path] : list_segments()) {
+            recover(n, path);
+            seq = std::max(seq, n + 1);
+        }
+        // The cap may have been lowered since the last boot
+        enforce_retention();
+        return open_active();
+    }
+
+    bool is_open() const { return fd != -1; }
+
+    void append(const std::string& service, pid_t pid, int64_t ts, const char* msg, size_t len) {
+        if (fd == -1) return;
+        
+        int id = index.service_id(service);
+        if (id == -1) {
+            // First record of this service in the segment: log its name
+            id = index.services.size();
+            index.services.push_back(service);
+            index.service_blocks.emplace_back();
+            JournalRecord name_rec = {ts, 0, (uint16_t)id, JOURNAL_NAME_ENTRY, (uint32_t)service.size(), 0};
+            index_record(index, name_rec, file_size + pending.size());
+            pending.append((const char*)&name_rec, sizeof(name_rec));
+            pending.append(service);
+        }
+        
+        JournalRecord rec = {ts, pid, (uint16_t)id, 0, (uint32_t)len, 0};
+        index_record(index, rec, file_size + pending.size());
+        pending.append((const char*)&rec, sizeof(rec));
+        pending.append(msg, len);
+        header.first_ts = std::min(header.first_ts, ts);
+        header.last_ts = std::max(header.last_ts, ts);
+        header.records++;
+    }
+
+    size_t pending_bytes() const { return pending.size(); }
+
+    void flush() {
+        if (fd == -1 || pending.empty()) return;
+        ssize_t n = pwrite(fd, pending.data(), pending.size(), file_size);
+        if (n > 0) file_size += n;
+        pending.clear();
+        
+        if (file_size >= JOURNAL_SEGMENT_SIZE) {
+            Segment full = detach_active();
+            seq++;
+            open_active();
+            std::lock_guard<std::mutex> lock(seal_mutex);
+            sealing.push_back(std::move(full));
+            // A running sealer picks it up
+            if (sealing.size() == 1) std::thread([this]() { run_sealer(); }).detach();
+        }
+    }
+
+    // Block until queued segments are sealed, for shutdown
+    void wait_sealed() {
+        std::unique_lock<std::mutex> lock(seal_mutex);
+        sealed_cv.wait(lock, [this]() { return sealing.empty(); });
+    }
+
+    // Drop the oldest sealed segments once the journal exceeds its cap
+    void enforce_retention() {
+        uint64_t busy = UINT64_MAX;
+        {
+            std::lock_guard<std::mutex> lock(seal_mutex);
+            if (!sealing.empty()) busy = sealing.front().seq;
+        }
+        auto segments = list_segments();
+        while (!segments.empty() && segments.back().first >= busy) segments.pop_back();
+        uint64_t total = 0;
+        std::vector<uint64_t> sizes;
+        for (const auto& [n, path] : segments) {
+            struct stat st;
+            sizes.push_back(stat(path.c_str(), &st) == 0 ? st.st_size : 0);
+            total += sizes.back();
+        }
+        for (size_t i = 0; i + 1 < segments.size() && total > max_bytes; i++) {
+            unlink(segments[i].second.c_str());
+            total -= sizes[i];
+        }
+    }
+
+    // Everything a reader thread needs, taken on the loop thread: open fds
+    // (so sealing and retention cannot pull files away) plus copies of the
+    // indexes of unsealed segments, which only exist in memory
+    struct Snapshot {
+        std::vector<int> sealed_fds;
+        std::vector<Segment> unsealed;  // queued for sealing, then the active one
+    };
+
+    Snapshot snapshot() {
+        flush();
+        Snapshot snap;
+        std::lock_guard<std::mutex> lock(seal_mutex);
+        std::set<uint64_t> skip;
+        for (const auto& seg : sealing) skip.insert(seg.seq);
+        if (fd != -1) skip.insert(seq);
+        for (const auto& [n, path] : list_segments()) {
+            if (skip.count(n)) continue;
+            int sfd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (sfd != -1) snap.sealed_fds.push_back(sfd);
+        }
+        for (const auto& seg : sealing) {
+            snap.unsealed.push_back(seg);
+            snap.unsealed.back().fd = fcntl(seg.fd, F_DUPFD_CLOEXEC, 0);
+        }
+        if (fd != -1) {
+            Segment active;
+            active.fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+            active.header = header;
+            active.index = index;
+            snap.unsealed.push_back(std::move(active));
+        }
+        return snap;
+    }
+
+    // Runs on a reader thread; emit() receives formatted lines
+    static void query(Snapshot& snap, const JournalQuery& q,
+                      const std::function<bool(const std::string&)>& emit) {
+        auto scan = [&](int sfd, const JournalHeader& hdr, const JournalIndex& idx) {
+            if (hdr.records == 0 || hdr.last_ts < q.since || hdr.first_ts > q.until) return true;
+            
+            std::vector<uint32_t> candidates;
+            int wanted = -1;
+            if (!q.service.empty()) {
+                wanted = idx.service_id(q.service);
+                if (wanted == -1) return true;
+                candidates = idx.service_blocks[wanted];
+            } else {
+                for (uint32_t i = 0; i < idx.blocks.size(); i++) candidates.push_back(i);
+            }
+
+            std::string stored, raw;
+            for (uint32_t b : candidates) {
+                const JournalBlock& block = idx.blocks[b];
+                if (block.last_ts < q.since || block.first_ts > q.until) continue;
+                
+                stored.resize(block.stored_len);
+                if (pread(sfd, &stored[0], block.stored_len, block.offset) != (ssize_t)block.stored_len) continue;
+                if (idx.flags & JOURNAL_ZSTD) {
+#ifdef AIRRIDE_ZSTD
+                    raw.resize(block.raw_len);
+                    size_t n = ZSTD_decompress(&raw[0], raw.size(), stored.data(), stored.size());
+                    if (ZSTD_isError(n)) continue;
+#else
+                    continue;
+#endif
+                } else {
+                    raw.swap(stored);
+                }
+
+                for (size_t pos = 0; pos + sizeof(JournalRecord) <= raw.size();) {
+                    JournalRecord rec;
+                    memcpy(&rec, raw.data() + pos, sizeof(rec));
+                    const char* msg = raw.data() + pos + sizeof(rec);
+                    pos += sizeof(rec) + rec.length;
+                    if (pos > raw.size()) break;
+                    if (rec.flags & JOURNAL_NAME_ENTRY) continue;
+                    if (wanted != -1 && rec.service != wanted) continue;
+                    if (rec.ts < q.since || rec.ts > q.until) continue;
+                    if (rec.service >= idx.services.size()) continue;
+                    
+                    char stamp[64];
+                    time_t secs = rec.ts / 1000000;
+                    struct tm tm;
+                    localtime_r(&secs, &tm);
+                    size_t len = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+                    snprintf(stamp + len, sizeof(stamp) - len, ".%06lld", (long long)(rec.ts % 1000000));
+                    
+                    std::string line = std::string(stamp) + " " + idx.services[rec.service] + "[" +
+                                       std::to_string(rec.pid) + "]: " + std::string(msg, rec.length) + "\n";
+                    if (!emit(line)) return false;
+                }
+            }
+            return true;
+        };
+
+        bool more = true;
+        for (int sfd : snap.sealed_fds) {
+            JournalHeader hdr;
+            JournalIndex idx;
+            if (more && pread(sfd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+                memcmp(hdr.magic, JOURNAL_MAGIC, 8) == 0 && (hdr.flags & JOURNAL_SEALED)) {
+                std::string buf(hdr.index_size, '\0');
+                if (pread(sfd, &buf[0], buf.size(), hdr.index_offset) == (ssize_t)buf.size() && idx.parse(buf)) {
+                    idx.flags = hdr.flags;
+                    more = scan(sfd, hdr, idx);
+                }
+            }
+            close(sfd);
+        }
+        for (const auto& seg : snap.unsealed) {
+            if (more && seg.fd != -1) more = scan(seg.fd, seg.header, seg.index);
+            if (seg.fd != -1) close(seg.fd);
+        }
+    }
+};
+
+struct ServiceView;
+
+struct Service {
+    std::string name;
+    std::string description;
+    ServiceType type = ServiceType::SIMPLE;
+    std::string exec_start;
+    std::string exec_stop;
+    std::vector<std::string> environment;  // KEY=VALUE from environment=
+    std::vector<std::string> argv;         // exec_start, split at load time
+    std::shared_ptr<const std::vector<std::string>> envp;  // complete environment for exec,
+                                                           // shared by a template's instances
+    std::string tty_device;  // TTY device for this service
+    std::vector<std::string> requires;
+    std::vector<std::string> after;
+    std::vector<std::string> instances;  // templates: instances created at load
+    std::string instance_of;  // template this unit was created from, "getty@"
+    bool restart_on_failure = false;
+    bool autostart = false;
+    bool parallel = false;
+    bool clear_screen = false;
+    bool foreground = false;
+    int restart_delay = 5;          // seconds before the first restart
+    int restart_max_delay = 300;    // backoff ceiling
+    double restart_backoff = 2;     // delay multiplier per consecutive failure
+    int restart_jitter = 10;        // +/- percent applied to each delay
+    int restart_burst = 5;          // give up after this many failures...
+    int restart_interval = 60;      // ...within this many seconds
+    int ready_timeout = 30;   // seconds a notify service has to report ready
+    int stop_timeout = 5;     // seconds after SIGTERM before SIGKILL
+    size_t log_max_size = 1 << 20;  // rotate <name>.log past this size
+    int log_max_files = 5;          // rotated files kept (<name>.log.1 ...)
+    int log_max_age = 0;            // rotate after this many seconds, 0 = never
+    pid_t pid = 0;
+    ServiceState state = ServiceState::STOPPED;
+    bool spawning = false;          // being cloned without services_mutex; pid not yet known
+    int failures = 0;               // consecutive; drives the backoff
+    std::deque<int64_t> recent_failures;  // monotonic us, inside restart_interval
+    uint64_t restart_seq = 0;       // bumped to void a pending restart
+    int notify_fd = -1;       // read end of the readiness pipe
+    int pidfd = -1;           // owned by the event loop while pid is alive
+    std::string status_text;  // last STATUS= line from a notify service
+    std::map<std::string, std::string> cgroup_limits;  // cgroup file -> value
+    ExecAttributes attrs;
+    std::string cgroup;       // cgroup directory of the current run, if any
+    ServiceTimeline timeline;
+    std::shared_ptr<Service> pending;  // edited on disk, applied at next start
+    bool removed = false;     // file deleted; erased once stopped
+    std::shared_ptr<const ServiceView> view;  // last published copy
+};
+
+// One address a .socket unit listens on
+struct Listener {
+    std::string address;    // /path for AF_UNIX, else [host:]port
+    int type = SOCK_STREAM;
+    int fd = -1;
+    bool armed = false;     // watched for activation; event loop thread only
+};
+
+// What list and status show of one unit, copied out of the live table
+struct ServiceView {
+    std::string name;
+    std::string description;
+    ServiceType type = ServiceType::SIMPLE;
+    ServiceState state = ServiceState::STOPPED;
+    pid_t pid = 0;
+    bool autostart = false;
+    bool socket = false;     // socket-activated
+    bool changed = false;    // edited on disk, restart to apply
+    int failures = 0;
+    std::string tty_device;
+    std::string status_text;
+    std::string cgroup;
+    ExecAttributes attrs;
+};
+
+// Immutable once published; readers hold on to the version they loaded.
+// Views of units that did not change are shared with the previous version.
+struct ServiceTable {
+    uint64_t version = 0;
+    std::vector<std::shared_ptr<const ServiceView>> services;  // sorted by name
+    
+    const ServiceView* find(const std::string& name) const {
+        auto it = std::lower_bound(services.begin(), services.end(), name,
+                                   [](const std::shared_ptr<const ServiceView>& v, const std::string& n) {
+                                       return v->name < n;
+                                   });
+        return it != services.end() && (*it)->name == name ? it->get() : nullptr;
+    }
+};
+
+// Sockets AirRide binds early in boot on behalf of a service. The first
+// connection starts the service, which inherits the listening fds.
+struct SocketUnit {
+    std::string name;
+    std::string service;    // defaults to the socket's own name
+    mode_t mode = 0666;     // permissions of AF_UNIX socket files
+    int backlog = SOMAXCONN;
+    std::vector<Listener> listeners;
+};
+
+// ---------------------------------------------------------------------------
+// Timer units
+//
+// A .timer file starts a service on a calendar schedule, a while after
+// boot, and/or at an interval after its last activation, optionally with a
+// random delay. Every timer is served by one CLOCK_REALTIME timerfd and a
+// min-heap of next elapse times on the event loop. Monotonic deadlines are
+// converted to wall time and recomputed whenever the clock is set. The
+// last activation of each timer is kept in paths.timer_state, so a
+// persistent calendar timer that was due while the machine was off runs
+// once right after boot.
+//
+// Calendar expressions: "[weekdays] [year-month-day] [hour:minute[:second]]"
+// where a field is *, a number, a list "1,15", a range "1..5" or a step
+// "*/15" ("0/15"), weekdays are Mon..Sun, and minutely, hourly, daily,
+// weekly, monthly and yearly are shorthands.
+// ---------------------------------------------------------------------------
+
+struct CalendarSpec {
+    uint64_t seconds = 0;       // bit n set: n matches
+    uint64_t minutes = 0;
+    uint32_t hours = 0;
+    uint32_t days = 0;          // bits 1..31
+    uint16_t months = 0;        // bits 1..12
+    uint8_t weekdays = 0x7f;    // bit 0 = Sunday
+    std::vector<int> years;     // empty: any
+};
+
+struct TimerUnit {
+    std::string name;
+    std::string service;        // defaults to the timer's own name
+    std::string on_calendar;    // as written, parsed into `calendar`
+    CalendarSpec calendar;
+    int on_boot = 0;            // seconds after boot
+    int on_active = 0;          // seconds after the last activation
+    int randomized_delay = 0;   // up to this many seconds added to each elapse
+    bool persistent = false;    // catch up a calendar run missed while down
+
+    int64_t last_wall = 0;      // epoch seconds of the last activation, 0 = never
+    int64_t last_mono = 0;      // monotonic_us of the last activation this boot
+    int64_t loaded_mono = 0;    // when a reload added it; 0 = at boot
+    int64_t next_us = 0;        // epoch microseconds, 0 = nothing scheduled
+    uint64_t generation = 0;    // heap entries of older schedules are stale
+};
+
+struct TimerElapse {
+    int64_t at;                 // epoch microseconds
+    std::string name;
+    uint64_t generation;
+    bool operator>(const TimerElapse& other) const { return at > other.at; }
+};
+
+// One calendar field into `bits`: "*", "5", "1,15", "1..5", "*/15", "0/15"
+// Calendar numbers are plain digits: no sign, blanks or trailing junk
+static bool parse_calendar_number(const std::string& text, int& out) {
+    return !text.empty() && isdigit((unsigned char)text[0]) && parse_int(text, out);
+}
+
+static bool parse_calendar_field(const std::string& field, int lo, int hi, uint64_t& bits) {
+    std::istringstream items(field);
+    std::string item;
+    bits = 0;
+    while (std::getline(items, item, ',')) {
+        int from = lo, to = hi, step = 1;
+        size_t slash = item.find('/');
+        if (slash != std::string::npos) {
+            if (!parse_calendar_number(item.substr(slash + 1), step) || step <= 0) return false;
+            item.erase(slash);
+        }
+        size_t dots = item.find("..");
+        if (item == "*") {
+        } else if (dots != std::string::npos) {
+            if (!parse_calendar_number(item.substr(0, dots), from) ||
+                !parse_calendar_number(item.substr(dots + 2), to)) return false;
+        } else {
+            if (!parse_calendar_number(item, from)) return false;
+            if (slash == std::string::npos) to = from;
+        }
+        if (from < lo || to > hi || from > to) return false;
+        for (int n = from; n <= to; n += step) bits |= 1ull << n;
+    }
+    return bits != 0;
+}
+
+static bool parse_weekdays(const std::string& field, uint8_t& bits) {
+    static const char* names[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    auto day = [](const std::string& name) {
+        for (int i = 0; i < 7; i++) {
+            if (strncasecmp(name.c_str(), names[i], 3) == 0) return i;
+        }
+        return -1;
+    };
+    std::istringstream items(field);
+    std::string item;
+    bits = 0;
+    while (std::getline(items, item, ',')) {
+        size_t dots = item.find("..");
+        int from = day(item.substr(0, dots));
+        int to = dots == std::string::npos ? from : day(item.substr(dots + 2));
+        if (from < 0 || to < 0) return false;
+        // Sat..Sun wraps around the week
+        for (int d = from;; d = (d + 1) % 7) {
+            bits |= 1 << d;
+            if (d == to) break;
+        }
+    }
+    return bits != 0;
+}
+
+static bool parse_calendar(std::string text, CalendarSpec& spec) {
+    static const std::map<std::string, std::string> shorthands = {
+        {"minutely", "*-*-* *:*:00"},
+        {"hourly", "*-*-* *:00:00"},
+        {"daily", "*-*-* 00:00:00"},
+        {"weekly", "Mon *-*-* 00:00:00"},
+        {"monthly", "*-*-01 00:00:00"},
+        {"yearly", "*-01-01 00:00:00"},
+    };
+    auto shorthand = shorthands.find(text);
+    if (shorthand != shorthands.end()) text = shorthand->second;
+
+    std::string weekdays, date = "*-*-*", time = "00:00:00";
+    std::istringstream words(text);
+    std::string word;
+    while (words >> word) {
+        if (isalpha((unsigned char)word[0])) weekdays = word;
+        else if (word.find(':') != std::string::npos) time = word;
+        else date = word;
+    }
+
+    spec = CalendarSpec();
+    if (!weekdays.empty() && !parse_weekdays(weekdays, spec.weekdays)) return false;
+
+    std::vector<std::string> d, t;
+    std::istringstream ds(date), ts(time);
+    std::string part;
+    while (std::getline(ds, part, '-')) d.push_back(part);
+    while (std::getline(ts, part, ':')) t.push_back(part);
+    if (d.size() == 2) d.insert(d.begin(), "*");
+    if (t.size() == 2) t.push_back("00");
+    if (d.size() != 3 || t.size() != 3) return false;
+
+    if (d[0] != "*") {
+        std::istringstream years(d[0]);
+        std::string year;
+        while (std::getline(years, year, ',')) {
+            size_t dots = year.find("..");
+            int from, to;
+            if (!parse_calendar_number(year.substr(0, dots), from)) return false;
+            if (dots == std::string::npos) to = from;
+            else if (!parse_calendar_number(year.substr(dots + 2), to)) return false;
+            if (from < 1970 || to < from || to - from > 1000) return false;
+            for (int y = from; y <= to; y++) spec.years.push_back(y);
+        }
+    }
+    uint64_t months, days, hours;
+    if (!parse_calendar_field(d[1], 1, 12, months) || !parse_calendar_field(d[2], 1, 31, days) ||
+        !parse_calendar_field(t[0], 0, 23, hours) || !parse_calendar_field(t[1], 0, 59, spec.minutes) ||
+        !parse_calendar_field(t[2], 0, 59, spec.seconds)) {
+        return false;
+    }
+    spec.months = months;
+    spec.days = days;
+    spec.hours = hours;
+    return true;
+}
+
+// First local time strictly after `after` (epoch seconds) that matches,
+// or -1 if there is none within the next few years
+static int64_t next_calendar_elapse(const CalendarSpec& spec, int64_t after) {
+    time_t t = after + 1;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    for (int day = 0; day < 366 * 5; day++) {
+        if (day > 0) {
+            // Midnight of the following day; mktime normalises month ends
+            tm.tm_mday++;
+            tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+            tm.tm_isdst = -1;
+            time_t next = mktime(&tm);
+            localtime_r(&next, &tm);
+        }
+        if (!(spec.months >> (tm.tm_mon + 1) & 1) || !(spec.days >> tm.tm_mday & 1) ||
+            !(spec.weekdays >> tm.tm_wday & 1)) {
+            continue;
+        }
+        if (!spec.years.empty() &&
+            std::find(spec.years.begin(), spec.years.end(), tm.tm_year + 1900) == spec.years.end()) {
+            continue;
+        }
+        for (int h = tm.tm_hour; h < 24; h++) {
+            if (!(spec.hours >> h & 1)) continue;
+            bool this_hour = h == tm.tm_hour;
+            for (int m = this_hour ? tm.tm_min : 0; m < 60; m++) {
+                if (!(spec.minutes >> m & 1)) continue;
+                bool this_minute = this_hour && m == tm.tm_min;
+                for (int s = this_minute ? tm.tm_sec : 0; s < 60; s++) {
+                    if (!(spec.seconds >> s & 1)) continue;
+                    struct tm match = tm;
+                    match.tm_hour = h;
+                    match.tm_min = m;
+                    match.tm_sec = s;
+                    match.tm_isdst = -1;
+                    return mktime(&match);
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+static std::string format_wall(int64_t sec) {
+    time_t t = sec;
+    struct tm tm;
+    char buf[32];
+    localtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    return buf;
+}
+
+// ---------------------------------------------------------------------------
+// Boot readahead
+//
+// A recording boot collects every regular file opened until shortly after
+// the autostart services are up (fanotify on the root filesystem, plus the
+// mappings of running services), then writes one line per file:
+//
+//     <disk offset> TAB <first page>+<pages>,... TAB <path>
+//
+// The page ranges are the parts of the file resident in the page cache at
+// that point (mincore), and lines are sorted by the physical offset of the
+// file's first extent (FIEMAP, the inode number where unsupported). A
+// replaying boot walks the list in that order on one thread and issues
+// readahead() for each range while mounts and unit loading go on, so a
+// spinning disk sweeps once instead of seeking for every exec.
+// ---------------------------------------------------------------------------
+
+struct ReadaheadEntry {
+    uint64_t offset = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;  // (first page, pages)
+    std::string path;
+};
+
+static uint64_t file_disk_offset(int fd, const struct stat& st) {
+    alignas(struct fiemap) char buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    memset(buffer, 0, sizeof(buffer));
+    auto* map = reinterpret_cast<struct fiemap*>(buffer);
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0) {
+        return map->fm_extents[0].fe_physical;
+    }
+    return st.st_ino;
+}
+
+// Runs of pages of `fd` that are in the page cache; the whole file when
+// that cannot be told
+static std::vector<std::pair<uint64_t, uint64_t>> resident_ranges(int fd, uint64_t size) {
+    static const uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t pages = (size + page - 1) / page;
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    if (pages == 0) return ranges;
+
+    void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    std::vector<unsigned char> resident(pages);
+    if (map == MAP_FAILED || mincore(map, size, resident.data()) == -1) {
+        if (map != MAP_FAILED) munmap(map, size);
+        ranges.push_back({0, pages});
+        return ranges;
+    }
+    munmap(map, size);
+
+    for (uint64_t i = 0; i < pages; i++) {
+        if (!(resident[i] & 1)) continue;
+        if (!ranges.empty() && ranges.back().first + ranges.back().second == i) ranges.back().second++;
+        else ranges.push_back({i, 1});
+    }
+    return ranges;
+}
+
+static bool write_readahead_list(const std::set<std::string>& files, size_t& written) {
+    std::vector<ReadaheadEntry> entries;
+    for (const auto& path : files) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+        if (fd == -1) fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) continue;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            ReadaheadEntry entry;
+            entry.ranges = resident_ranges(fd, st.st_size);
+            if (!entry.ranges.empty()) {
+                entry.offset = file_disk_offset(fd, st);
+                entry.path = path;
+                entries.push_back(std::move(entry));
+            }
+        }
+        close(fd);
+    }
+    std::sort(entries.begin(), entries.end(), [](const ReadaheadEntry& a, const ReadaheadEntry& b) {
+        return a.offset != b.offset ? a.offset < b.offset : a.path < b.path;
+    });
+
+    std::ostringstream out;
+    out << "# airride readahead 1\n";
+    for (const auto& entry : entries) {
+        out << entry.offset << '\t';
+        for (size_t i = 0; i < entry.ranges.size(); i++) {
+            if (i) out << ',';
+            out << entry.ranges[i].first << '+' << entry.ranges[i].second;
+        }
+        out << '\t' << entry.path << '\n';
+    }
+
+    std::string dir = paths.readahead.substr(0, paths.readahead.rfind('/'));
+    if (!dir.empty()) mkdir(dir.c_str(), 0755);
+    std::string tmp = paths.readahead + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) return false;
+    std::string data = out.str();
+    bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+    close(fd);
+    if (!ok || rename(tmp.c_str(), paths.readahead.c_str()) == -1) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    written = entries.size();
+    return true;
+}
+
+// Prefetch everything in the list; returns false when there is no list
+static bool replay_readahead_list(size_t& files, uint64_t& bytes) {
+    std::ifstream in(paths.readahead);
+    if (!in) return false;
+    static const uint64_t page = sysconf(_SC_PAGESIZE);
+    files = 0;
+    bytes = 0;
+
+    std::string line;
+    while (std::getline(in, line) && bytes < READAHEAD_MAX_BYTES) {
+        if (line.empty() || line[0] == '#') continue;
+        size_t tab1 = line.find('\t');
+        size_t tab2 = tab1 == std::string::npos ? tab1 : line.find('\t', tab1 + 1);
+        if (tab2 == std::string::npos) continue;
+        std::string path = line.substr(tab2 + 1);
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+        if (fd == -1) fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) continue;
+
+        std::istringstream ranges(line.substr(tab1 + 1, tab2 - tab1 - 1));
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            unsigned long long first = 0, count = 0;
+            if (sscanf(range.c_str(), "%llu+%llu", &first, &count) != 2 || count == 0) continue;
+            readahead(fd, first * page, count * page);
+            bytes += count * page;
+        }
+        close(fd);
+        files++;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Device manager
+//
+// Kernel uevents arrive on a netlink socket watched by the event loop. As
+// PID 1, AirRide replays every device under /sys/devices at boot
+// ("coldplug") by writing "add" to its uevent file from a few threads,
+// gives each device node the mode and owner of the first matching rule in
+// paths.devices, and hands new MODALIAS values to modprobe in batches.
+// Units order themselves after a device node with after=dev:<path> (or
+// requires=dev:<path>) and start as soon as the kernel announces it.
+//
+// Rules are "<match> <mode> [user[:group]]" per line, where <match> is a
+// glob on the name below /dev or "subsystem:<name>".
+// ---------------------------------------------------------------------------
+
+struct DeviceRule {
+    std::string match;
+    mode_t mode = 0600;
+    uid_t uid = 0;
+    gid_t gid = 0;
+};
+
+// Used without a rules file; matches what the fixed device nodes had
+static const char* DEFAULT_DEVICE_RULES =
+    "tty[0-9]* 0620\n"
+    "ttyS* 0660\n"
+    "fb* 0666\n"
+    "dri/* 0666\n";
+
+// A numeric user or group id; names are looked up before this
+static bool parse_id(const std::string& value, int& out) {
+    return !value.empty() && isdigit((unsigned char)value[0]) && parse_int(value, out);
+}
+
+// A rule with a bad mode or an unknown owner is skipped rather than
+// applied as 0 or root
+static std::vector<DeviceRule> parse_device_rules(std::istream& in, const std::string& source) {
+    std::vector<DeviceRule> rules;
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line)) {
+        lineno++;
+        line.erase(std::min(line.find('#'), line.size()));
+        std::istringstream fields(line);
+        DeviceRule rule;
+        std::string mode, owner, extra;
+        if (!(fields >> rule.match)) continue;
+        int n = 0;
+        bool valid = fields >> mode && isdigit((unsigned char)mode[0]) && parse_int(mode, n, 8) && n <= 07777;
+        rule.mode = n;
+        if (valid && fields >> owner) {
+            std::string user = owner.substr(0, owner.find(':'));
+            std::string group = owner.find(':') != std::string::npos ? owner.substr(owner.find(':') + 1) : "";
+            struct passwd* pw = getpwnam(user.c_str());
+            if (pw) rule.uid = pw->pw_uid;
+            else if (!user.empty() && (valid = parse_id(user, n))) rule.uid = n;
+            if (!group.empty()) {
+                struct group* gr = getgrnam(group.c_str());
+                if (gr) rule.gid = gr->gr_gid;
+                else if (valid && (valid = parse_id(group, n))) rule.gid = n;
+            } else if (pw) {
+                rule.gid = pw->pw_gid;
+            }
+            if (valid && fields >> extra) valid = false;
+        }
+        if (!valid) {
+            std::cerr << "[AirRide] " << source << ":" << lineno << ": bad device rule, skipped: " << line << std::endl;
+            continue;
+        }
+        rules.push_back(rule);
+    }
+    return rules;
+}
+
+// "add@/devices/...\0ACTION=add\0KEY=VALUE\0..." as sent by the kernel
+static std::map<std::string, std::string> parse_uevent(const char* buf, size_t len) {
+    std::map<std::string, std::string> env;
+    size_t pos = strnlen(buf, len) + 1;
+    while (pos < len) {
+        size_t n = strnlen(buf + pos, len - pos);
+        const char* eq = (const char*)memchr(buf + pos, '=', n);
+        if (eq) env[std::string(buf + pos, eq)] = std::string(eq + 1, buf + pos + n);
+        pos += n + 1;
+    }
+    return env;
+}
+
+// "dev:sda" and "dev:/dev/sda" name /dev/sda; empty for ordinary units
+static std::string device_node(const std::string& dep) {
+    if (dep.compare(0, 4, "dev:") != 0 || dep.size() == 4) return "";
+    return dep[4] == '/' ? dep.substr(4) : "/dev/" + dep.substr(4);
+}
+
+// Every uevent file below `dir`; symlinks are skipped, so each device
+// is found once
+static void collect_uevents(const std::string& dir, std::vector<std::string>& out) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != nullptr) {
+        if (entry->d_name[0] == '.') continue;
+        std::string path = dir + "/" + entry->d_name;
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(path.c_str(), &st) == -1) continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+        }
+        if (type == DT_DIR) collect_uevents(path, out);
+        else if (type == DT_REG && strcmp(entry->d_name, "uevent") == 0) out.push_back(path);
+    }
+    closedir(d);
+}
+
+// ---------------------------------------------------------------------------
+// Compiled unit cache
+//
+// SERVICES_DIR is compiled into one binary snapshot so that boot does not
+// parse every unit file. Layout: UnitCacheHeader, then the body. The body
+// is the string table, the source file table (name, mtime, size), the unit
+// name table and the unit records. Strings are interned and referenced by
+// offset. Dependencies are unit indices where they resolve. The snapshot
+// is only trusted when the directory mtime, every file's mtime and size,
+// the environment used for $VAR expansion and the body checksum all match.
+// ---------------------------------------------------------------------------
+
+struct UnitCacheHeader {
+    char magic[4];          // "ARUC"
+    uint32_t version;
+    uint64_t body_size;
+    uint64_t checksum;      // FNV-1a of the body
+    uint64_t env_hash;      // FNV-1a of environ at compile time
+    int64_t dir_mtime;      // ns
+};
+
+struct UnitFile {
+    std::string name;
+    std::string unit;       // unit it defined, empty if it did not parse
+    int64_t mtime = 0;      // ns
+    uint64_t size = 0;
+};
+
+#define DEP_BY_NAME 0x80000000u  // dependency on a unit not in the cache
+
+static uint64_t fnv1a(const void* data, size_t len, uint64_t hash = 1469598103934665603ull) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint64_t environ_hash() {
+    uint64_t hash = fnv1a(nullptr, 0);
+    for (char** e = environ; *e; e++) hash = fnv1a(*e, strlen(*e) + 1, hash);
+    return hash;
+}
+
+static int64_t mtime_ns(const struct stat& st) {
+    return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+class UnitCacheWriter {
+private:
+    std::string strings;
+    std::unordered_map<std::string, uint32_t> interned;
+
+public:
+    std::string records;
+
+    void u32(uint32_t v) { records.append((const char*)&v, sizeof(v)); }
+    void u64(uint64_t v) { records.append((const char*)&v, sizeof(v)); }
+    void f64(double v) { records.append((const char*)&v, sizeof(v)); }
+
+    void str(const std::string& s) {
+        auto it = interned.find(s);
+        if (it == interned.end()) {
+            it = interned.emplace(s, (uint32_t)strings.size()).first;
+            strings.append(s.c_str(), s.size() + 1);
+        }
+        u32(it->second);
+    }
+
+    void strs(const std::vector<std::string>& list) {
+        u32(list.size());
+        for (const auto& s : list) str(s);
+    }
+
+    // Header + body, ready to be written out
+    std::string finish(int64_t dir_mtime) {
+        std::string body;
+        uint64_t string_bytes = strings.size();
+        body.append((const char*)&string_bytes, sizeof(string_bytes));
+        body += strings;
+        body += records;
+        
+        UnitCacheHeader hdr = {{'A', 'R', 'U', 'C'}, UNIT_CACHE_VERSION, body.size(),
+                               fnv1a(body.data(), body.size()), environ_hash(), dir_mtime};
+        return std::string((const char*)&hdr, sizeof(hdr)) + body;
+    }
+};
+
+// Bounds-checked reads over the mapped body; `ok` drops on any overrun
+class UnitCacheReader {
+private:
+    const char* strings = nullptr;
+    uint64_t string_bytes = 0;
+    const char* p;
+    const char* end;
+
+public:
+    bool ok = true;
+
+    UnitCacheReader(const char* body, size_t size) : p(body), end(body + size) {
+        string_bytes = u64();
+        if (!ok || string_bytes > (uint64_t)(end - p)) {
+            ok = false;
+            return;
+        }
+        strings = p;
+        p += string_bytes;
+    }
+
+    template <typename T> T scalar() {
+        T v{};
+        if ((size_t)(end - p) < sizeof(T)) {
+            ok = false;
+            return v;
+        }
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
+    }
+    uint32_t u32() { return scalar<uint32_t>(); }
+    uint64_t u64() { return scalar<uint64_t>(); }
+    double f64() { return scalar<double>(); }
+
+    std::string str() {
+        uint32_t off = u32();
+        if (!ok || off >= string_bytes) {
+            ok = false;
+            return "";
+        }
+        return std::string(strings + off, strnlen(strings + off, string_bytes - off));
+    }
+
+    std::vector<std::string> strs() {
+        uint32_t n = u32();
+        std::vector<std::string> list;
+        for (uint32_t i = 0; i < n && ok; i++) list.push_back(str());
+        return list;
+    }
+};
+
+// Single-threaded epoll reactor. fd handlers and timers run on the thread
+// calling run_once(); other threads hand work over with post().
+class EventLoop {
+public:
+    using Handler = std::function<void(uint32_t)>;
+    using Callback = std::function<void()>;
+    using Clock = std::chrono::steady_clock;
+
+private:
+    int epoll_fd = -1;
+    int timer_fd = -1;
+    int wake_fd = -1;
+    std::unordered_map<int, std::shared_ptr<Handler>> handlers;
+    std::multimap<Clock::time_point, std::pair<uint64_t, Callback>> timers;
+    uint64_t next_timer_id = 1;
+    std::mutex posted_mutex;
+    std::vector<Callback> posted;
+
+    void arm_timer() {
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        if (!timers.empty()) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                timers.begin()->first.time_since_epoch()).count();
+            if (ns <= 0) ns = 1;
+            its.it_value.tv_sec = ns / 1000000000;
+            its.it_value.tv_nsec = ns % 1000000000;
+        }
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+    }
+
+    void run_timers() {
+        uint64_t expirations;
+        while (read(timer_fd, &expirations, sizeof(expirations)) > 0) {}
+
+        auto now = Clock::now();
+        while (!timers.empty() && timers.begin()->first <= now) {
+            Callback cb = std::move(timers.begin()->second.second);
+            timers.erase(timers.begin());
+            cb();
+        }
+        arm_timer();
+    }
+
+    void run_posted() {
+        uint64_t count;
+        while (read(wake_fd, &count, sizeof(count)) > 0) {}
+
+        std::vector<Callback> batch;
+        {
+            std::lock_guard<std::mutex> lock(posted_mutex);
+            batch.swap(posted);
+        }
+        for (auto& cb : batch) cb();
+    }
+
+public:
+    ~EventLoop() {
+        if (timer_fd != -1) close(timer_fd);
+        if (wake_fd != -1) close(wake_fd);
+        if (epoll_fd != -1) close(epoll_fd);
+    }
+
+    bool init() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd == -1 || timer_fd == -1 || wake_fd == -1) return false;
+
+        watch(timer_fd, EPOLLIN, [this](uint32_t) { run_timers(); });
+        watch(wake_fd, EPOLLIN, [this](uint32_t) { run_posted(); });
+        return true;
+    }
+
+    bool watch(int fd, uint32_t events, Handler handler) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) return false;
+        handlers[fd] = std::make_shared<Handler>(std::move(handler));
+        return true;
+    }
+
+    void modify(int fd, uint32_t events) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    void unwatch(int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        handlers.erase(fd);
+    }
+
+    uint64_t add_timer(int delay_ms, Callback cb) {
+        uint64_t id = next_timer_id++;
+        auto deadline = Clock::now() + std::chrono::milliseconds(delay_ms);
+        bool earliest = timers.empty() || deadline < timers.begin()->first;
+        timers.emplace(deadline, std::make_pair(id, std::move(cb)));
+        if (earliest) arm_timer();
+        return id;
+    }
+
+    void cancel_timer(uint64_t id) {
+        for (auto it = timers.begin(); it != timers.end(); ++it) {
+            if (it->second.first == id) {
+                timers.erase(it);
+                arm_timer();
+                return;
+            }
+        }
+    }
+
+    // Thread-safe: queue a callback to run on the loop thread
+    void post(Callback cb) {
+        {
+            std::lock_guard<std::mutex> lock(posted_mutex);
+            posted.push_back(std::move(cb));
+        }
+        uint64_t one = 1;
+        write(wake_fd, &one, sizeof(one));
+    }
+
+    // Block until at least one fd or timer is ready, then dispatch
+    void run_once() {
+        struct epoll_event events[32];
+        int n = epoll_wait(epoll_fd, events, 32, -1);
+        for (int i = 0; i < n; i++) {
+            auto it = handlers.find(events[i].data.fd);
+            if (it == handlers.end()) continue;
+            // Keep the handler alive even if it unwatches itself
+            std::shared_ptr<Handler> handler = it->second;
+            (*handler)(events[i].events);
+        }
+    }
+};
+
+// Fixed-size pool of detached threads. The queue lives in shared state so
+// workers never outlive what they touch, even when PID 1 is torn down.
+class WorkerPool {
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::function<void()>> tasks;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+
+public:
+    void start(size_t workers) {
+        for (size_t i = 0; i < workers; i++) {
+            std::thread([state = state]() {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(state->mutex);
+                        state->cv.wait(lock, [&] { return !state->tasks.empty(); });
+                        task = std::move(state->tasks.front());
+                        state->tasks.pop_front();
+                    }
+                    task();
+                }
+            }).detach();
+        }
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->tasks.push_back(std::move(task));
+        }
+        state->cv.notify_one();
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Control protocol, version 2
+//
+// Every message is a 16-byte ControlFrame header followed by `length`
+// payload bytes. A client sends FRAME_REQUEST frames whose payload is a
+// command line ("start a b c"). Requests may be pipelined on a single
+// connection and are matched to replies by `id`. A reply is any number
+// of FRAME_DATA chunks followed by one FRAME_END. FRAME_END has
+// CONTROL_FAILED set when the command failed. CONTROL_JSON on a request
+// asks for machine-readable output. A connection whose first bytes are
+// not the magic speaks the old one-command text protocol and is closed
+// after its reply.
+// ---------------------------------------------------------------------------
+
+#define CONTROL_VERSION 2
+#define FRAME_REQUEST 1
+#define FRAME_DATA 2
+#define FRAME_END 3
+#define CONTROL_JSON 0x1                // request flag
+#define CONTROL_FAILED 0x1              // FRAME_END flag
+#define CONTROL_MAX_REQUEST (1 << 20)
+#define CONTROL_CHUNK (64 << 10)        // largest FRAME_DATA payload sent
+#define CONTROL_HIGH_WATER (1 << 20)    // queued output that stalls producers
+
+struct ControlFrame {
+    char magic[2];          // "AR"
+    uint8_t version;
+    uint8_t type;
+    uint16_t flags;
+    uint16_t reserved;
+    uint32_t id;
+    uint32_t length;
+};
+static_assert(sizeof(ControlFrame) == 16, "control frame layout");
+
+// One client connection. Replies may be queued from any thread; the
+// socket itself is only closed and unwatched on the event loop thread.
+class ControlConnection {
+private:
+    EventLoop& loop;
+    std::mutex mutex;
+    std::condition_variable drained;
+    std::string out;
+    bool closed = false;
+    bool polling_out = false;
+
+    // Called with mutex held
+    void flush_locked() {
+        while (!out.empty()) {
+            ssize_t n = write(fd, out.data(), out.size());
+            if (n > 0) {
+                out.erase(0, n);
+            } else if (n == -1 && errno == EAGAIN) {
+                if (!polling_out) {
+                    loop.modify(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+                    polling_out = true;
+                }
+                return;
+            } else {
+                // Peer is gone; the loop sees the hangup and closes us
+                out.clear();
+                shutdown(fd, SHUT_RDWR);
+                break;
+            }
+        }
+        if (polling_out) {
+            loop.modify(fd, EPOLLIN | EPOLLRDHUP);
+            polling_out = false;
+        }
+        if (finished) shutdown(fd, SHUT_RDWR);
+        drained.notify_all();
+    }
+
+    bool queue(const std::string& bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed) return false;
+        out += bytes;
+        flush_locked();
+        return !closed;
+    }
+
+    static std::string frame(uint8_t type, uint16_t flags, uint32_t id, const char* data, size_t len) {
+        ControlFrame hdr = {{'A', 'R'}, CONTROL_VERSION, type, flags, 0, id, (uint32_t)len};
+        std::string bytes((const char*)&hdr, sizeof(hdr));
+        return bytes.append(data, len);
+    }
+
+public:
+    const int fd;
+    bool legacy = false;    // old text protocol; decided on the first read
+    bool finished = false;  // legacy reply done: hang up once flushed
+    std::string inbuf;      // event loop thread only
+
+    ControlConnection(EventLoop& loop, int fd) : loop(loop), fd(fd) {}
+
+    bool send_data(uint32_t id, const std::string& text) {
+        if (legacy) return queue(text);
+        std::string bytes;
+        for (size_t pos = 0; pos < text.size(); pos += CONTROL_CHUNK) {
+            bytes += frame(FRAME_DATA, 0, id, text.data() + pos, std::min(text.size() - pos, (size_t)CONTROL_CHUNK));
+        }
+        return queue(bytes);
+    }
+
+    void send_end(uint32_t id, bool failed) {
+        if (legacy) {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            if (!closed) flush_locked();
+            return;
+        }
+        queue(frame(FRAME_END, failed ? CONTROL_FAILED : 0, id, nullptr, 0));
+    }
+
+    void reply(uint32_t id, const std::string& text, bool failed = false) {
+        if (!text.empty()) send_data(id, text);
+        send_end(id, failed);
+    }
+
+    size_t queued() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return out.size();
+    }
+
+    // Block a producer thread until the client has caught up; false once closed
+    bool wait_writable() {
+        std::unique_lock<std::mutex> lock(mutex);
+        drained.wait(lock, [this] { return closed || out.size() < CONTROL_HIGH_WATER; });
+        return !closed;
+    }
+
+    // Event loop thread only
+    void on_writable() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!closed) flush_locked();
+    }
+
+    // Event loop thread only
+    void close_connection() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed) return;
+        closed = true;
+        loop.unwatch(fd);
+        close(fd);
+        drained.notify_all();
+    }
+};
+
+// One node per unit pulled into a start transaction
+struct StartNode {
+    std::string name;
+    std::vector<std::pair<size_t, bool>> dependents;  // (node, hard requires edge)
+    size_t pending = 0;        // predecessors not yet settled
+    bool missing = false;      // no such service
+    bool dep_failed = false;   // a required predecessor failed
+    bool serial = false;       // parallel=false: one at a time
+    bool tty = false;
+    bool device = false;       // a dev: dependency rather than a unit
+    bool cyclic = false;       // on a dependency cycle: fails without starting
+    bool ok = false;
+    std::string waited_on;
+};
+
+// A start transaction waiting for a device node to be announced
+struct DeviceWait {
+    std::string path;
+    std::function<void(bool)> done;
+};
+
+#define JOB_HISTORY 64    // finished jobs kept for `jobs` and `wait`
+#define JOB_WORKERS 16    // stops that can run at the same time; starts do not hold one
+
+enum class JobType {
+    START,
+    STOP,
+    RESTART
+};
+
+#define SHUTDOWN_KILL_WAIT 3   // seconds allowed after SIGKILL
+
+enum class ShutdownAction {
+    EXIT,       // test mode: stop services and return
+    HALT,
+    POWEROFF,
+    REBOOT
+};
+
+enum class JobState {
+    WAITING,    // queued behind another job for the same unit
+    RUNNING,
+    DONE,
+    CANCELED    // replaced by a conflicting job before it ran
+};
+
+// One queued operation on one unit. A unit has at most one running and
+// one waiting job; new requests merge into those where they can.
+struct Job {
+    uint32_t id = 0;
+    JobType type = JobType::START;
+    std::string unit;
+    JobState state = JobState::WAITING;
+    bool ok = false;
+    int64_t queued = 0;
+    int64_t started = 0;
+    int64_t finished = 0;
+    std::vector<std::function<void(const Job&)>> on_done;  // guarded by jobs_mutex
+};
+
+class AirRide {
+private:
+    std::map<std::string, Service> services;
+    std::atomic<bool> running{true};
+    std::atomic<bool> shutting_down{false};
+    ShutdownAction shutdown_action = ShutdownAction::EXIT;
+    int control_socket = -1;
+    int signal_fd = -1;
+    sigset_t handled_signals;
+    std::mutex services_mutex;
+    std::condition_variable services_cv;
+    // Callbacks for units that have not settled yet; guarded by services_mutex
+    std::multimap<std::string, std::function<void(bool)>> settle_waiters;
+    // list/status read a published copy, swapped whole, so they never wait
+    // on services_mutex; changes are batched into one republish
+    std::shared_ptr<const ServiceTable> service_table = std::make_shared<ServiceTable>();
+    std::atomic<bool> table_dirty{false};
+    uint64_t table_version = 0;      // event loop thread only
+    std::unordered_map<pid_t, Service*> pid_index;  // guarded by services_mutex
+    // Exits reaped before the starter published the pid; guarded by services_mutex
+    std::unordered_map<pid_t, int> early_exits;
+    unsigned spawns_in_flight = 0;
+    EventLoop loop;
+    WorkerPool start_pool;
+    
+    // Start slots bound how many services are being launched at once,
+    // across all transactions; PSI triggers hold back new launches
+    std::mutex slots_mutex;
+    std::deque<std::function<void()>> slot_waiting;
+    unsigned slots_total = 1;
+    unsigned slots_used = 0;
+    bool under_pressure = false;     // guarded by slots_mutex
+    uint64_t pressure_seq = 0;       // event loop thread only
+    WorkerPool job_pool;
+    std::mutex jobs_mutex;
+    uint32_t next_job_id = 1;
+    std::map<std::string, std::pair<std::shared_ptr<Job>, std::shared_ptr<Job>>> unit_jobs;  // (running, waiting)
+    std::deque<std::shared_ptr<Job>> job_history;
+    int64_t init_started = 0;
+    std::vector<BootPhase> boot_phases;  // guarded by services_mutex
+    std::map<std::string, LogStream> log_streams;  // event loop thread only
+    Journal journal;                               // event loop thread only
+    bool journal_flush_armed = false;
+    bool cgroups = false;  // per-service cgroups below paths.cgroup
+    bool cgroup_created = false;  // paths.cgroup was made by us, removed on test-mode exit
+    std::map<std::string, SocketUnit> sockets;  // guarded by services_mutex
+    std::map<std::string, std::shared_ptr<const Service>> templates;  // "getty@", guarded by services_mutex
+    std::map<std::string, TimerUnit> timer_units;  // event loop thread only
+    std::priority_queue<TimerElapse, std::vector<TimerElapse>, std::greater<TimerElapse>> timer_heap;
+    int timer_units_fd = -1;
+    std::minstd_rand timer_rng{(unsigned)realtime_us()};
+    std::map<std::string, UnitFile> unit_files;  // event loop thread only
+    int inotify_fd = -1;
+    bool reload_armed = false;
+    bool record_readahead = false;
+    int uevent_fd = -1;
+    bool manage_devices = false;                // PID 1: rules, modules, coldplug
+    std::vector<DeviceRule> device_rules;       // event loop thread only
+    std::vector<std::string> modaliases;        // event loop thread only, for the next modprobe
+    std::mutex devices_mutex;
+    std::set<std::string> devices;              // announced nodes, guarded by devices_mutex
+    std::map<uint64_t, DeviceWait> device_waits;  // guarded by devices_mutex
+    uint64_t next_device_wait = 0;
+    std::atomic<bool> boot_done{false};
+    int readahead_fd = -1;                      // fanotify while recording
+    std::set<std::string> readahead_files;      // event loop thread only
+    std::minstd_rand restart_rng{(unsigned)monotonic_us()};  // guarded by services_mutex
+
+    void record_phase(const std::string& name, int64_t start) {
+        std::lock_guard<std::mutex> lock(services_mutex);
+        boot_phases.push_back({name, start, monotonic_us()});
+    }
+
+    void mount_filesystems() {
+        std::cout << "[AirRide] Mounting filesystems..." << std::endl;
+        
+        mkdir("/proc", 0755);
+        mkdir("/sys", 0755);
+        mkdir("/dev", 0755);
+        mkdir("/run", 0755);
+        mkdir("/tmp", 0755);
+        mkdir("/dev/pts", 0755);
+        mkdir("/var/log", 0755);
+        mkdir(paths.logs.c_str(), 0755);
+        mkdir("/usr/share/udhcpc", 0755);
+        
+        mount("proc", "/proc", "proc", MS_NOEXEC | MS_NOSUID | MS_NODEV, nullptr);
+        mount("sysfs", "/sys", "sysfs", MS_NOEXEC | MS_NOSUID | MS_NODEV, nullptr);
+        mount("cgroup2", CGROUP_ROOT, "cgroup2", MS_NOEXEC | MS_NOSUID | MS_NODEV, "nsdelegate");
+        mount("devtmpfs", "/dev", "devtmpfs", MS_NOSUID, "mode=0755");
+        mount("devpts", "/dev/pts", "devpts", 0, "gid=5,mode=620");
+        mount("tmpfs", "/run", "tmpfs", MS_NOEXEC | MS_NOSUID | MS_NODEV, "mode=0755");
+        mount("tmpfs", "/tmp", "tmpfs", MS_NOEXEC | MS_NOSUID | MS_NODEV, "mode=1777");
+        
+        // Nodes AirRide itself needs before coldplug
+        mknod("/dev/console", S_IFCHR | 0600, makedev(5, 1));
+        mknod("/dev/null", S_IFCHR | 0666, makedev(1, 3));
+        mknod("/dev/zero", S_IFCHR | 0666, makedev(1, 5));
+        mknod("/dev/random", S_IFCHR | 0666, makedev(1, 8));
+        mknod("/dev/urandom", S_IFCHR | 0666, makedev(1, 9));
+        mknod("/dev/tty", S_IFCHR | 0666, makedev(5, 0));
+        // Hardware nodes come from devtmpfs and the device manager
+        
+        // Set hostname early
+        set_hostname();
+        
+        std::cout << "[AirRide] Filesystems ready" << std::endl;
+    }
+
+    // Quiet when asked, or as PID 1 when the kernel was booted with "quiet"
+    void setup_console() {
+        bool quiet = console_option == "quiet";
+        if (console_option.empty() && getpid() == 1) {
+            std::istringstream cmdline(read_file("/proc/cmdline"));
+            std::string word;
+            while (cmdline >> word) quiet = quiet || word == "quiet";
+        } else if (!quiet && console_option != "verbose" && !console_option.empty()) {
+            std::cerr << "[AirRide] Bad console mode: " << console_option << std::endl;
+        }
+        console.set_quiet(quiet);
+    }
+
+    void set_hostname() {
+        std::ifstream hf("/etc/hostname");
+        std::string hostname = "galactica";
+        if (hf.is_open()) {
+            std::getline(hf, hostname);
+            hf.close();
+        }
+        if (!hostname.empty()) {
+            sethostname(hostname.c_str(), hostname.length());
+        }
+    }
+
+    void clear_console() {
+        // Let queued progress land before the screen goes
+        console.drain(CONSOLE_SETTLE_MS);
+        int fd = open("/dev/console", O_WRONLY);
+        if (fd >= 0) {
+            const char* clear = "\033[2J\033[H";
+            write(fd, clear, strlen(clear));
+            close(fd);
+        }
+        std::cout << "\033[2J\033[H" << std::flush;
+    }
+
+    bool parse_service_file(const std::string& filepath, Service& svc) {
+        std::ifstream file(filepath);
+        if (!file.is_open()) return false;
+
+        std::string line, current_section;
+
+        while (std::getline(file, line)) {
+            line.erase(0, line.find_first_not_of(" \t"));
+            line.erase(line.find_last_not_of(" \t\r\n") + 1);
+            
+            if (line.empty() || line[0] == '#') continue;
+            
+            if (line[0] == '[' && line.back() == ']') {
+                current_section = line.substr(1, line.length()-2);
+                continue;
+            }
+            
+            size_t eq = line.find('=');
+            if (eq == std::string::npos) continue;
+            
+            std::string key = line.substr(0, eq);
+            std::string value = line.substr(eq + 1);
+            key.erase(key.find_last_not_of(" \t") + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            
+            if (value.length() >= 2 && value[0] == '"' && value.back() == '"')
+                value = value.substr(1, value.length()-2);
+            
+            auto is_true = [](const std::string& v) {
+                return v == "true" || v == "yes" || v == "1";
+            };
+            // A bad value keeps the default; a typo must not take init down
+            auto invalid = [&]() {
+                std::cerr << "[AirRide] Invalid value for key " << key << " in " << filepath
+                          << ": " << value << std::endl;
+            };
+            
+            if (current_section == "Service") {
+                if (key == "name") svc.name = value;
+                else if (key == "description") svc.description = value;
+                else if (key == "exec_start") svc.exec_start = value;
+                else if (key == "instances") {
+                    // "tty1 tty2" or "{1..4}"
+                    std::istringstream ss(value);
+                    std::string word;
+                    while (ss >> word) {
+                        for (auto& name : expand_braces(word)) svc.instances.push_back(name);
+                    }
+                }
+                else if (key == "exec_stop") svc.exec_stop = value;
+                else if (key == "environment") {
+                    std::string error;
+                    if (!split_command(value, svc.environment, error)) {
+                        std::cerr << "[AirRide] " << filepath << ": environment: " << error << std::endl;
+                    }
+                }
+                else if (key == "tty") svc.tty_device = value;
+                else if (key == "autostart") svc.autostart = is_true(value);
+                else if (key == "parallel") svc.parallel = is_true(value);
+                else if (key == "clear_screen") svc.clear_screen = is_true(value);
+                else if (key == "foreground") svc.foreground = is_true(value);
+                else if (key == "type") {
+                    if (value == "simple") svc.type = ServiceType::SIMPLE;
+                    else if (value == "forking") svc.type = ServiceType::FORKING;
+                    else if (value == "oneshot") svc.type = ServiceType::ONESHOT;
+                    else if (value == "notify") svc.type = ServiceType::NOTIFY;
+                }
+                else if (key == "restart") svc.restart_on_failure = (value == "on-failure" || value == "always");
+                else if (key == "restart_delay") {
+                    if (!parse_duration(value, svc.restart_delay)) invalid();
+                }
+                else if (key == "restart_max_delay") {
+                    if (!parse_duration(value, svc.restart_max_delay)) invalid();
+                }
+                else if (key == "restart_backoff") {
+                    char* end;
+                    double n = strtod(value.c_str(), &end);
+                    if (!value.empty() && *end == '\0' && std::isfinite(n)) svc.restart_backoff = std::max(1.0, n);
+                    else invalid();
+                }
+                else if (key == "restart_jitter" || key == "restart_burst") {
+                    int n;
+                    if (!parse_int(value, n) || n < 0) invalid();
+                    else if (key == "restart_jitter") svc.restart_jitter = std::min(100, n);
+                    else svc.restart_burst = n;
+                }
+                else if (key == "restart_interval") {
+                    if (!parse_duration(value, svc.restart_interval)) invalid();
+                }
+                else if (key == "ready_timeout") {
+                    int n;
+                    if (parse_int(value, n) && n >= 0) svc.ready_timeout = n;
+                    else invalid();
+                }
+                else if (key == "stop_timeout") {
+                    if (!parse_duration(value, svc.stop_timeout)) invalid();
+                }
+                else if (key == "log_max_size") {
+                    if (!parse_size(value, svc.log_max_size)) invalid();
+                }
+                else if (key == "log_max_files") {
+                    int n;
+                    if (parse_int(value, n) && n >= 0) svc.log_max_files = n;
+                    else invalid();
+                }
+                else if (key == "log_max_age") {
+                    if (!parse_duration(value, svc.log_max_age)) invalid();
+                }
+                else if (key == "cpu_weight") svc.cgroup_limits["cpu.weight"] = value;
+                else if (key == "io_weight") svc.cgroup_limits["io.weight"] = "default " + value;
+                else if (key == "pids_max") svc.cgroup_limits["pids.max"] = value;
+                else if (key == "cpu_max") {
+                    // "50%" of one CPU, or the raw "<quota> <period>" form
+                    if (!value.empty() && value.back() == '%') {
+                        int percent;
+                        if (!parse_int(value.substr(0, value.size() - 1), percent) ||
+                            percent <= 0 || percent > INT_MAX / 1000) {
+                            invalid();
+                            continue;
+                        }
+                        value = std::to_string(percent * 1000) + " 100000";
+                    }
+                    svc.cgroup_limits["cpu.max"] = value;
+                }
+                else if (key == "cpu_affinity") {
+                    if (!parse_cpu_list(value, svc.attrs.cpu_affinity)) invalid();
+                }
+                else if (key == "nice") {
+                    int n;
+                    if (parse_int(value, n)) svc.attrs.nice = std::max(-20, std::min(19, n));
+                    else invalid();
+                }
+                else if (key == "sched_policy") {
+                    // "fifo 50", "rr 10", "batch", "idle", "other"; a bare
+                    // "fifo" or "rr" runs at priority 1
+                    std::istringstream ss(value);
+                    std::string policy, priority, extra;
+                    ss >> policy >> priority >> extra;
+                    int n = 1;
+                    bool realtime = policy == "fifo" || policy == "rr";
+                    if (!extra.empty() || (!realtime && !priority.empty()) ||
+                        (!priority.empty() && (!isdigit((unsigned char)priority[0]) ||
+                                               !parse_int(priority, n) || n < 1 || n > 99))) {
+                        invalid();
+                        continue;
+                    }
+                    if (policy == "other") svc.attrs.sched_policy = SCHED_OTHER;
+                    else if (policy == "batch") svc.attrs.sched_policy = SCHED_BATCH;
+                    else if (policy == "idle") svc.attrs.sched_policy = SCHED_IDLE;
+                    else if (policy == "fifo") svc.attrs.sched_policy = SCHED_FIFO;
+                    else if (policy == "rr") svc.attrs.sched_policy = SCHED_RR;
+                    else {
+                        invalid();
+                        continue;
+                    }
+                    svc.attrs.sched_priority = realtime ? n : 0;
+                }
+                else if (key == "io_class") {
+                    if (value == "realtime") svc.attrs.io_class = 1;
+                    else if (value == "best-effort") svc.attrs.io_class = 2;
+                    else if (value == "idle") svc.attrs.io_class = 3;
+                    else std::cerr << "[AirRide] " << filepath << ": bad io_class " << value << std::endl;
+                }
+                else if (key == "io_priority") {
+                    int n;
+                    if (!parse_int(value, n)) {
+                        invalid();
+                        continue;
+                    }
+                    svc.attrs.io_priority = std::max(0, std::min(7, n));
+                    if (svc.attrs.io_class == 0) svc.attrs.io_class = 2;
+                }
+                else if (key == "oom_score_adjust") {
+                    int n;
+                    if (parse_int(value, n)) svc.attrs.oom_score_adjust = std::max(-1000, std::min(1000, n));
+                    else invalid();
+                }
+                else if (key == "timer_slack") {
+                    // "50000" ns, or with a ns/us/ms suffix
+                    std::string digits = value;
+                    long scale = 1;
+                    if (value.size() > 2 && value.compare(value.size() - 2, 2, "ns") == 0) digits.resize(value.size() - 2);
+                    else if (value.size() > 2 && value.compare(value.size() - 2, 2, "us") == 0) {
+                        digits.resize(value.size() - 2);
+                        scale = 1000;
+                    }
+                    else if (value.size() > 2 && value.compare(value.size() - 2, 2, "ms") == 0) {
+                        digits.resize(value.size() - 2);
+                        scale = 1000000;
+                    }
+                    int n;
+                    if (parse_int(digits, n) && n >= 0) svc.attrs.timer_slack = n * scale;
+                    else invalid();
+                }
+                else if (key == "memory_max" || key == "memory_high") {
+                    size_t bytes;
+                    if (value != "max" && !parse_size(value, bytes)) {
+                        invalid();
+                        continue;
+                    }
+                    if (value != "max") value = std::to_string(bytes);
+                    svc.cgroup_limits[key == "memory_max" ? "memory.max" : "memory.high"] = value;
+                }
+            }
+            else if (current_section == "Dependencies") {
+                if (key == "requires" || key == "after") {
+                    std::vector<std::string>& target = (key == "requires") ? svc.requires : svc.after;
+                    std::istringstream ss(value);
+                    std::string dep;
+                    while (ss >> dep) target.push_back(dep);
+                }
+            }
+        }
+
+        return !svc.name.empty() && prepare_exec(svc, filepath);
+    }
+
+    bool parse_socket_file(const std::string& filepath, SocketUnit& sock) {
+        std::ifstream file(filepath);
+        if (!file.is_open()) return false;
+
+        std::string line, current_section;
+        while (std::getline(file, line)) {
+            line.erase(0, line.find_first_not_of(" \t"));
+            line.erase(line.find_last_not_of(" \t\r\n") + 1);
+            if (line.empty() || line[0] == '#') continue;
+            if (line[0] == '[' && line.back() == ']') {
+                current_section = line.substr(1, line.length()-2);
+                continue;
+            }
+            
+            size_t eq = line.find('=');
+            if (eq == std::string::npos || current_section != "Socket") continue;
+            std::string key = line.substr(0, eq);
+            std::string value = line.substr(eq + 1);
+            key.erase(key.find_last_not_of(" \t") + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            
+            if (key == "name") sock.name = value;
+            else if (key == "service") sock.service = value;
+            else if (key == "socket_mode" || key == "backlog") {
+                int n;
+                if (!parse_int(value, n, key == "socket_mode" ? 8 : 10) || n < 0) {
+                    std::cerr << "[AirRide] Invalid value for key " << key << " in " << filepath
+                              << ": " << value << std::endl;
+                }
+                else if (key == "socket_mode") sock.mode = n & 07777;
+                else sock.backlog = n;
+            }
+            else if (key == "listen_stream" || key == "listen_datagram") {
+                Listener l;
+                l.address = value;
+                l.type = key == "listen_stream" ? SOCK_STREAM : SOCK_DGRAM;
+                sock.listeners.push_back(l);
+            }
+        }
+        
+        if (sock.name.empty() || sock.listeners.empty()) return false;
+        if (sock.service.empty()) sock.service = sock.name;
+        if (sock.listeners.size() > SOCKET_MAX_FDS) sock.listeners.resize(SOCKET_MAX_FDS);
+        return true;
+    }
+
+    bool parse_timer_file(const std::string& filepath, TimerUnit& timer) {
+        std::ifstream file(filepath);
+        if (!file.is_open()) return false;
+
+        std::string line, current_section;
+        while (std::getline(file, line)) {
+            line.erase(0, line.find_first_not_of(" \t"));
+            line.erase(line.find_last_not_of(" \t\r\n") + 1);
+            if (line.empty() || line[0] == '#') continue;
+            if (line[0] == '[' && line.back() == ']') {
+                current_section = line.substr(1, line.length()-2);
+                continue;
+            }
+            
+            size_t eq = line.find('=');
+            if (eq == std::string::npos || current_section != "Timer") continue;
+            std::string key = line.substr(0, eq);
+            std::string value = line.substr(eq + 1);
+            key.erase(key.find_last_not_of(" \t") + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            
+            if (key == "name") timer.name = value;
+            else if (key == "service") timer.service = value;
+            else if (key == "on_calendar") timer.on_calendar = value;
+            else if (key == "on_boot" || key == "on_active" || key == "randomized_delay") {
+                int& target = key == "on_boot" ? timer.on_boot :
+                              key == "on_active" ? timer.on_active : timer.randomized_delay;
+                if (!parse_duration(value, target)) {
+                    std::cerr << "[AirRide] Invalid value for key " << key << " in " << filepath
+                              << ": " << value << std::endl;
+                }
+            }
+            else if (key == "persistent") timer.persistent = value == "true" || value == "yes";
+        }
+        
+        if (timer.name.empty()) return false;
+        if (timer.service.empty()) timer.service = timer.name;
+        if (!timer.on_calendar.empty() && !parse_calendar(timer.on_calendar, timer.calendar)) {
+            std::cerr << "[AirRide] " << filepath << ": bad on_calendar " << timer.on_calendar << std::endl;
+            return false;
+        }
+        return !timer.on_calendar.empty() || timer.on_boot > 0 || timer.on_active > 0;
+    }
+
+    // Resolve exec_start and environment= into the argv and envp handed
+    // to exec, once, so starting a service only builds pointer arrays
+    static bool prepare_exec(Service& svc, const std::string& origin) {
+        std::string error;
+        svc.argv.clear();
+        if (!split_command(svc.exec_start, svc.argv, error) || svc.argv.empty()) {
+            std::cerr << "[AirRide] " << origin << ": exec_start: "
+                      << (error.empty() ? "no command" : error) << std::endl;
+            return false;
+        }
+        
+        std::map<std::string, std::string> env;
+        auto assign = [&env](const std::string& entry) {
+            size_t eq = entry.find('=');
+            if (eq != std::string::npos && eq > 0) env[entry.substr(0, eq)] = entry;
+        };
+        for (char** e = environ; *e; e++) assign(*e);
+        for (const auto& entry : svc.environment) assign(entry);
+        
+        auto envp = std::make_shared<std::vector<std::string>>();
+        for (const auto& [key, entry] : env) envp->push_back(entry);
+        svc.envp = std::move(envp);
+        return true;
+    }
+
+    // Run one unit file parser. Whatever it throws fails that file, not
+    // init: reload parses files an editor may be halfway through saving.
+    template <typename Parse>
+    static bool parse_guarded(const std::string& fname, Parse parse) {
+        try {
+            return parse();
+        } catch (const std::exception& e) {
+            std::cerr << "[AirRide] Cannot parse " << fname << ": " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    void load_services() {
+        std::cout << "[AirRide] Loading services..." << std::endl;
+        
+        // Emergency shell - always available
+        Service shell;
+        shell.name = "shell";
+        shell.description = "Emergency Shell";
+        shell.type = ServiceType::SIMPLE;
+        shell.exec_start = "/bin/sh";
+        shell.foreground = true;
+        prepare_exec(shell, "shell");
+        services["shell"] = shell;
+        
+        bool cached = load_unit_cache();
+        if (!cached) {
+            for (auto& [fname, f] : scan_unit_files()) {
+                std::string path = paths.services + "/" + fname;
+                if (is_socket_file(fname)) {
+                    SocketUnit sock;
+                    if (parse_guarded(fname, [&]() { return parse_socket_file(path, sock); })) {
+                        f.unit = sock.name;
+                        sockets[sock.name] = sock;
+                    }
+                } else if (is_timer_file(fname)) {
+                    TimerUnit timer;
+                    if (parse_guarded(fname, [&]() { return parse_timer_file(path, timer); })) {
+                        f.unit = timer.name;
+                        timer_units[timer.name] = timer;
+                    }
+                } else {
+                    Service svc;
+                    if (parse_guarded(fname, [&]() { return parse_service_unit(fname, svc); })) {
+                        f.unit = svc.name;
+                        std::lock_guard<std::mutex> lock(services_mutex);
+                        if (is_template_file(fname)) templates[svc.name] = std::make_shared<const Service>(svc);
+                        else services[svc.name] = svc;
+                    }
+                }
+                unit_files[fname] = f;
+            }
+            write_unit_cache();
+        }
+        {
+            std::lock_guard<std::mutex> lock(services_mutex);
+            for (const auto& [name, tmpl] : templates) create_listed_instances(*tmpl);
+        }
+        
+        std::cout << "[AirRide] " << services.size() << " services loaded";
+        if (!templates.empty()) std::cout << ", " << templates.size() << " templates";
+        if (!sockets.empty()) std::cout << ", " << sockets.size() << " sockets";
+        if (!timer_units.empty()) std::cout << ", " << timer_units.size() << " timers";
+        if (cached) std::cout << " (cached)";
+        std::cout << std::endl;
+        publish_service_table();
+    }
+
+    static bool is_socket_file(const std::string& fname) {
+        return fname.length() > 7 && fname.substr(fname.length()-7) == ".socket";
+    }
+
+    static bool is_template_file(const std::string& fname) {
+        return fname.length() > 9 && fname.substr(fname.length()-9) == "@.service";
+    }
+
+    // parse_service_file() for a .service file; a template is named after
+    // its file whatever name= says
+    bool parse_service_unit(const std::string& fname, Service& svc) {
+        std::string stem = fname.substr(0, fname.size() - 8);
+        if (is_template_file(fname)) svc.name = stem;
+        if (!parse_service_file(paths.services + "/" + fname, svc)) return false;
+        if (is_template_file(fname)) svc.name = stem;
+        return true;
+    }
+
+    // The unit called `name`, created from its template if it is an
+    // instance nobody has asked for yet; services.end() if neither.
+    // Called with services_mutex held.
+    std::map<std::string, Service>::iterator find_or_instantiate(const std::string& name) {
+        auto it = services.find(name);
+        if (it != services.end()) return it;
+        auto tmpl = templates.find(template_of(name));
+        Service svc;
+        if (tmpl == templates.end() || !make_instance(*tmpl->second, name, svc)) return services.end();
+        it = services.emplace(name, std::move(svc)).first;
+        services_changed();
+        return it;
+    }
+
+    // The definition of instance `name`: the template with %i filled in.
+    // The exec environment is shared, not copied.
+    static bool make_instance(const Service& tmpl, const std::string& name, Service& svc) {
+        std::string instance = name.substr(name.find('@') + 1);
+        if (instance.empty()) return false;
+        svc = tmpl;
+        svc.name = name;
+        svc.instance_of = tmpl.name;
+        svc.instances.clear();
+        svc.description = expand_instance(tmpl.description, instance);
+        svc.exec_start = expand_instance(tmpl.exec_start, instance);
+        svc.exec_stop = expand_instance(tmpl.exec_stop, instance);
+        svc.tty_device = expand_instance(tmpl.tty_device, instance);
+        for (auto& dep : svc.requires) dep = expand_instance(dep, instance);
+        for (auto& dep : svc.after) dep = expand_instance(dep, instance);
+        std::string error;
+        svc.argv.clear();
+        return split_command(svc.exec_start, svc.argv, error) && !svc.argv.empty();
+    }
+
+    // Called with services_mutex held
+    void create_listed_instances(const Service& tmpl) {
+        for (const auto& instance : tmpl.instances) find_or_instantiate(tmpl.name + instance);
+    }
+
+    static bool is_timer_file(const std::string& fname) {
+        return fname.length() > 6 && fname.substr(fname.length()-6) == ".timer";
+    }
+
+    // Every .service/.socket/.timer file with its mtime and size
+    static std::map<std::string, UnitFile> scan_unit_files() {
+        std::map<std::string, UnitFile> files;
+        DIR* dir = opendir(paths.services.c_str());
+        if (!dir) return files;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            std::string fname = entry->d_name;
+            bool is_service = fname.length() > 8 && fname.substr(fname.length()-8) == ".service";
+            if (!is_service && !is_socket_file(fname) && !is_timer_file(fname)) continue;
+            
+            struct stat st;
+            std::string path = paths.services + "/" + fname;
+            if (stat(path.c_str(), &st) == 0) files[fname] = {fname, "", mtime_ns(st), (uint64_t)st.st_size};
+        }
+        closedir(dir);
+        return files;
+    }
+
+    // Everything parse_service_file() produces, in cache order
+    static void write_definition(UnitCacheWriter& w, const Service& svc,
+                                 const std::function<void(const std::vector<std::string>&)>& deps) {
+        w.str(svc.description);
+        w.u32((uint32_t)svc.type);
+        w.str(svc.exec_start);
+        w.str(svc.exec_stop);
+        w.str(svc.tty_device);
+        deps(svc.requires);
+        deps(svc.after);
+        w.u32(svc.restart_on_failure | svc.autostart << 1 | svc.parallel << 2 |
+              svc.clear_screen << 3 | svc.foreground << 4);
+        w.u32(svc.restart_delay);
+        w.u32(svc.restart_max_delay);
+        w.f64(svc.restart_backoff);
+        w.u32(svc.restart_jitter);
+        w.u32(svc.restart_burst);
+        w.u32(svc.restart_interval);
+        w.u32(svc.ready_timeout);
+        w.u32(svc.stop_timeout);
+        w.u64(svc.log_max_size);
+        w.u32(svc.log_max_files);
+        w.u32(svc.log_max_age);
+        w.strs(svc.environment);
+        w.strs(svc.argv);
+        w.strs(svc.envp ? *svc.envp : std::vector<std::string>());
+        w.strs(svc.instances);
+        w.u32(svc.cgroup_limits.size());
+        for (const auto& [file, value] : svc.cgroup_limits) {
+            w.str(file);
+            w.str(value);
+        }
+        const ExecAttributes& a = svc.attrs;
+        w.u32(a.cpu_affinity.size());
+        for (int cpu : a.cpu_affinity) w.u32(cpu);
+        w.u32(a.nice);
+        w.u32(a.sched_policy);
+        w.u32(a.sched_priority);
+        w.u32(a.io_class);
+        w.u32(a.io_priority);
+        w.u32(a.oom_score_adjust);
+        w.u64(a.timer_slack);
+    }
+
+    // Two definitions are the same unit if they serialise identically
+    static bool same_definition(const Service& a, const Service& b) {
+        auto bytes = [](const Service& svc) {
+            UnitCacheWriter w;
+            w.str(svc.name);
+            write_definition(w, svc, [&w](const std::vector<std::string>& deps) { w.strs(deps); });
+            return w.finish(0);
+        };
+        return bytes(a) == bytes(b);
+    }
+
+    // Unit definitions only; runtime state is never cached. Loop thread.
+    void write_unit_cache() {
+        struct stat dir_st;
+        int64_t dir_mtime = stat(paths.services.c_str(), &dir_st) == 0 ? mtime_ns(dir_st) : 0;
+        
+        UnitCacheWriter w;
+        w.u32(unit_files.size());
+        for (const auto& [fname, f] : unit_files) {
+            w.str(f.name);
+            w.str(f.unit);
+            w.u64(f.mtime);
+            w.u64(f.size);
+        }
+        
+        std::lock_guard<std::mutex> lock(services_mutex);
+        std::map<std::string, uint32_t> index;
+        std::vector<const Service*> units;
+        for (const auto& [name, svc] : services) {
+            // Instances are made again from their template on demand
+            if (name == "shell" || svc.removed || !svc.instance_of.empty()) continue;
+            index[name] = units.size();
+            units.push_back(svc.pending ? svc.pending.get() : &svc);
+        }
+        for (const auto& [name, tmpl] : templates) {
+            index[name] = units.size();
+            units.push_back(tmpl.get());
+        }
+        w.u32(units.size());
+        for (const Service* svc : units) w.str(svc->name);
+        
+        auto deps = [&](const std::vector<std::string>& list) {
+            w.u32(list.size());
+            for (const auto& dep : list) {
+                auto it = index.find(dep);
+                if (it != index.end()) {
+                    w.u32(it->second);
+                } else {
+                    w.u32(DEP_BY_NAME);
+                    w.str(dep);
+                }
+            }
+        };
+        for (const Service* svc : units) write_definition(w, *svc, deps);
+        
+        w.u32(sockets.size());
+        for (const auto& [name, sock] : sockets) {
+            w.str(sock.name);
+            w.str(sock.service);
+            w.u32(sock.mode);
+            w.u32(sock.backlog);
+            w.u32(sock.listeners.size());
+            for (const auto& l : sock.listeners) {
+                w.str(l.address);
+                w.u32(l.type);
+            }
+        }
+        
+        w.u32(timer_units.size());
+        for (const auto& [name, timer] : timer_units) {
+            w.str(timer.name);
+            w.str(timer.service);
+            w.str(timer.on_calendar);
+            w.u32(timer.on_boot);
+            w.u32(timer.on_active);
+            w.u32(timer.randomized_delay);
+            w.u32(timer.persistent);
+        }
+        
+        // Best effort: a read-only root just means parsing next boot too
+        std::string data = w.finish(dir_mtime);
+        std::string dir = paths.cache;
+        dir.erase(dir.rfind('/'));
+        mkdir(dir.substr(0, dir.rfind('/')).c_str(), 0755);
+        mkdir(dir.c_str(), 0755);
+        std::string tmp = paths.cache + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) return;
+        bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+        close(fd);
+        if (!ok || rename(tmp.c_str(), paths.cache.c_str()) == -1) unlink(tmp.c_str());
+    }
+
+    // Fill services/sockets from the snapshot; false if it is stale or
+    // damaged, in which case nothing has been loaded
+    bool load_unit_cache() {
+        int fd = ::open(paths.cache.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return false;
+        struct stat st;
+        if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(UnitCacheHeader)) {
+            close(fd);
+            return false;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return false;
+        
+        bool ok = parse_unit_cache((const char*)map, st.st_size);
+        munmap(map, st.st_size);
+        return ok;
+    }
+
+    bool parse_unit_cache(const char* data, size_t size) {
+        UnitCacheHeader hdr;
+        memcpy(&hdr, data, sizeof(hdr));
+        const char* body = data + sizeof(hdr);
+        struct stat dir_st;
+        if (memcmp(hdr.magic, "ARUC", 4) != 0 || hdr.version != UNIT_CACHE_VERSION ||
+            hdr.body_size != size - sizeof(hdr) || hdr.env_hash != environ_hash() ||
+            stat(paths.services.c_str(), &dir_st) == -1 || hdr.dir_mtime != mtime_ns(dir_st) ||
+            hdr.checksum != fnv1a(body, hdr.body_size)) {
+            return false;
+        }
+        
+        UnitCacheReader r(body, hdr.body_size);
+        std::map<std::string, UnitFile> files;
+        uint32_t file_count = r.u32();
+        for (uint32_t i = 0; i < file_count && r.ok; i++) {
+            UnitFile f;
+            f.name = r.str();
+            f.unit = r.str();
+            f.mtime = r.u64();
+            f.size = r.u64();
+            std::string path = paths.services + "/" + f.name;
+            struct stat st;
+            if (stat(path.c_str(), &st) == -1 || mtime_ns(st) != f.mtime || (uint64_t)st.st_size != f.size) {
+                return false;
+            }
+            files[f.name] = f;
+        }
+        
+        uint32_t unit_count = r.u32();
+        std::vector<std::string> names;
+        for (uint32_t i = 0; i < unit_count && r.ok; i++) names.push_back(r.str());
+        
+        auto deps = [&](std::vector<std::string>& list) {
+            uint32_t n = r.u32();
+            for (uint32_t i = 0; i < n && r.ok; i++) {
+                uint32_t dep = r.u32();
+                if (dep == DEP_BY_NAME) list.push_back(r.str());
+                else if (dep < names.size()) list.push_back(names[dep]);
+                else r.ok = false;
+            }
+        };
+        std::map<std::string, Service> loaded;
+        for (uint32_t i = 0; i < unit_count && r.ok; i++) {
+            Service svc;
+            svc.name = names[i];
+            svc.description = r.str();
+            svc.type = (ServiceType)r.u32();
+            svc.exec_start = r.str();
+            svc.exec_stop = r.str();
+            svc.tty_device = r.str();
+            deps(svc.requires);
+            deps(svc.after);
+            uint32_t flags = r.u32();
+            svc.restart_on_failure = flags & 1;
+            svc.autostart = flags & 2;
+            svc.parallel = flags & 4;
+            svc.clear_screen = flags & 8;
+            svc.foreground = flags & 16;
+            svc.restart_delay = r.u32();
+            svc.restart_max_delay = r.u32();
+            svc.restart_backoff = r.f64();
+            svc.restart_jitter = r.u32();
+            svc.restart_burst = r.u32();
+            svc.restart_interval = r.u32();
+            svc.ready_timeout = r.u32();
+            svc.stop_timeout = r.u32();
+            svc.log_max_size = r.u64();
+            svc.log_max_files = r.u32();
+            svc.log_max_age = r.u32();
+            svc.environment = r.strs();
+            svc.argv = r.strs();
+            svc.envp = std::make_shared<const std::vector<std::string>>(r.strs());
+            svc.instances = r.strs();
+            uint32_t limits = r.u32();
+            for (uint32_t j = 0; j < limits && r.ok; j++) {
+                std::string file = r.str();
+                svc.cgroup_limits[file] = r.str();
+            }
+            ExecAttributes& a = svc.attrs;
+            uint32_t cpus = r.u32();
+            for (uint32_t j = 0; j < cpus && r.ok; j++) a.cpu_affinity.push_back(r.u32());
+            a.nice = (int32_t)r.u32();
+            a.sched_policy = (int32_t)r.u32();
+            a.sched_priority = r.u32();
+            a.io_class = r.u32();
+            a.io_priority = r.u32();
+            a.oom_score_adjust = (int32_t)r.u32();
+            a.timer_slack = r.u64();
+            loaded[svc.name] = std::move(svc);
+        }
+        
+        std::map<std::string, SocketUnit> loaded_sockets;
+        uint32_t socket_count = r.u32();
+        for (uint32_t i = 0; i < socket_count && r.ok; i++) {
+            SocketUnit sock;
+            sock.name = r.str();
+            sock.service = r.str();
+            sock.mode = r.u32();
+            sock.backlog = r.u32();
+            uint32_t n = r.u32();
+            for (uint32_t j = 0; j < n && r.ok; j++) {
+                Listener l;
+                l.address = r.str();
+                l.type = r.u32();
+                sock.listeners.push_back(l);
+            }
+            loaded_sockets[sock.name] = sock;
+        }
+        
+        std::map<std::string, TimerUnit> loaded_timers;
+        uint32_t timer_count = r.u32();
+        for (uint32_t i = 0; i < timer_count && r.ok; i++) {
+            TimerUnit timer;
+            timer.name = r.str();
+            timer.service = r.str();
+            timer.on_calendar = r.str();
+            timer.on_boot = r.u32();
+            timer.on_active = r.u32();
+            timer.randomized_delay = r.u32();
+            timer.persistent = r.u32();
+            if (!timer.on_calendar.empty() && !parse_calendar(timer.on_calendar, timer.calendar)) r.ok = false;
+            loaded_timers[timer.name] = timer;
+        }
+        if (!r.ok) return false;
+        
+        std::lock_guard<std::mutex> lock(services_mutex);
+        for (auto& [name, svc] : loaded) {
+            if (name.back() == '@') templates[name] = std::make_shared<const Service>(std::move(svc));
+            else services[name] = std::move(svc);
+        }
+        sockets = std::move(loaded_sockets);
+        timer_units = std::move(loaded_timers);
+        unit_files = std::move(files);
+        return true;
+    }
+
+    // Called with services_mutex held. Swap in a new definition while
+    // keeping the unit's runtime state; the Service object stays put, so
+    // pid_index and other pointers remain valid.
+    static void apply_definition(Service& svc, Service def) {
+        def.pid = svc.pid;
+        def.state = svc.state;
+        def.failures = svc.failures;
+        def.recent_failures = std::move(svc.recent_failures);
+        def.restart_seq = svc.restart_seq;
+        def.notify_fd = svc.notify_fd;
+        def.pidfd = svc.pidfd;
+        def.status_text = svc.status_text;
+        def.cgroup = svc.cgroup;
+        def.timeline = svc.timeline;
+        def.pending.reset();
+        def.removed = false;
+        svc = std::move(def);
+    }
+
+    // Re-read only unit files whose mtime or size changed and apply the
+    // difference in place: new units are added (not started), edited
+    // stopped units take effect at once, edited running units are flagged
+    // and switch over at their next start, and units whose file is gone
+    // are stopped and dropped. Event loop thread only.
+    std::string reload_services() {
+        std::map<std::string, UnitFile> files = scan_unit_files();
+        std::vector<std::string> added, changed, pending, removed;
+        std::set<std::string> service_units, socket_units, timer_names, template_names;
+        
+        for (auto& [fname, f] : files) {
+            auto old = unit_files.find(fname);
+            bool is_socket = is_socket_file(fname);
+            bool is_timer = is_timer_file(fname);
+            bool is_template = is_template_file(fname);
+            std::set<std::string>& units = is_socket ? socket_units : is_timer ? timer_names :
+                                           is_template ? template_names : service_units;
+            if (old != unit_files.end() && old->second.mtime == f.mtime && old->second.size == f.size) {
+                f.unit = old->second.unit;
+                if (!f.unit.empty()) units.insert(f.unit);
+                continue;
+            }
+            
+            std::string path = paths.services + "/" + fname;
+            // A file that does not parse (say, half-written) keeps its old unit
+            auto keep = [&]() {
+                if (old == unit_files.end() || old->second.unit.empty()) return;
+                f.unit = old->second.unit;
+                units.insert(f.unit);
+                std::cerr << "[AirRide] Cannot load " << fname << ", keeping " << f.unit << std::endl;
+            };
+            if (is_socket) {
+                SocketUnit sock;
+                if (!parse_guarded(fname, [&]() { return parse_socket_file(path, sock); })) {
+                    keep();
+                    continue;
+                }
+                f.unit = sock.name;
+                socket_units.insert(sock.name);
+                if (update_socket(sock)) changed.push_back(sock.name + ".socket");
+                continue;
+            }
+            if (is_timer) {
+                TimerUnit timer;
+                if (!parse_guarded(fname, [&]() { return parse_timer_file(path, timer); })) {
+                    keep();
+                    continue;
+                }
+                f.unit = timer.name;
+                timer_names.insert(timer.name);
+                if (update_timer(timer)) changed.push_back(timer.name + ".timer");
+                continue;
+            }
+            
+            Service def;
+            if (!parse_guarded(fname, [&]() { return parse_service_unit(fname, def); })) {
+                keep();
+                continue;
+            }
+            f.unit = def.name;
+            units.insert(def.name);
+            
+            std::lock_guard<std::mutex> lock(services_mutex);
+            if (is_template) {
+                update_template(std::move(def), added, changed, pending);
+                continue;
+            }
+            auto it = services.find(def.name);
+            if (it == services.end()) {
+                services[def.name] = def;
+                added.push_back(def.name);
+                continue;
+            }
+            redefine_service(it->second, def, changed, pending);
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(services_mutex);
+            for (auto& [name, svc] : services) {
+                if (name == "shell" || svc.removed || service_units.count(name)) continue;
+                if (!svc.instance_of.empty() && template_names.count(svc.instance_of)) continue;
+                svc.removed = true;
+                removed.push_back(name);
+            }
+            for (auto it = templates.begin(); it != templates.end();) {
+                if (template_names.count(it->first)) {
+                    ++it;
+                    continue;
+                }
+                removed.push_back(it->first);
+                it = templates.erase(it);
+            }
+            for (auto it = sockets.begin(); it != sockets.end();) {
+                if (socket_units.count(it->first)) {
+                    ++it;
+                    continue;
+                }
+                removed.push_back(it->first + ".socket");
+                close_socket(it->second);
+                it = sockets.erase(it);
+            }
+            // Heap entries of a dropped timer find nothing when they come due
+            for (auto it = timer_units.begin(); it != timer_units.end();) {
+                if (timer_names.count(it->first)) {
+                    ++it;
+                    continue;
+                }
+                removed.push_back(it->first + ".timer");
+                it = timer_units.erase(it);
+            }
+            // Socket units may have moved between services
+            for (auto& [name, svc] : services) svc.view.reset();
+            services_changed();
+        }
+        for (const auto& name : removed) {
+            if (!is_socket_file(name) && !is_timer_file(name) && name.back() != '@') retire_service(name);
+        }
+        
+        unit_files = std::move(files);
+        write_unit_cache();
+        
+        std::stringstream ss;
+        ss << "Reloaded: " << added.size() << " added, " << changed.size() + pending.size()
+           << " changed, " << removed.size() << " removed\n";
+        auto names = [&ss](const char* label, const std::vector<std::string>& list) {
+            if (list.empty()) return;
+            ss << "  " << label << ":";
+            for (const auto& n : list) ss << " " << n;
+            ss << "\n";
+        };
+        names("added", added);
+        names("changed", changed);
+        names("restart to apply", pending);
+        names("removed", removed);
+        std::cout << "[AirRide] " << ss.str() << std::flush;
+        return ss.str();
+    }
+
+    // Called with services_mutex held, on the loop thread
+    void close_socket(SocketUnit& sock) {
+        for (auto& l : sock.listeners) {
+            if (l.armed) loop.unwatch(l.fd);
+            if (l.fd != -1) close(l.fd);
+            if (l.fd != -1 && l.address[0] == '/') unlink(l.address.c_str());
+            l.fd = -1;
+            l.armed = false;
+        }
+    }
+
+    // Bind a new or edited socket unit; false if nothing changed
+    bool update_socket(SocketUnit sock) {
+        std::lock_guard<std::mutex> lock(services_mutex);
+        auto it = sockets.find(sock.name);
+        if (it != sockets.end()) {
+            const SocketUnit& old = it->second;
+            bool same = old.service == sock.service && old.mode == sock.mode &&
+                        old.backlog == sock.backlog && old.listeners.size() == sock.listeners.size();
+            for (size_t i = 0; same && i < sock.listeners.size(); i++) {
+                same = old.listeners[i].address == sock.listeners[i].address &&
+                       old.listeners[i].type == sock.listeners[i].type;
+            }
+            if (same) return false;
+            close_socket(it->second);
+        }
+        
+        for (auto& l : sock.listeners) {
+            if (!bind_listener(sock, l)) {
+                std::cerr << "[AirRide] " << sock.name << ": cannot listen on " << l.address
+                          << ": " << strerror(errno) << std::endl;
+                if (l.fd != -1) close(l.fd);
+                l.fd = -1;
+            }
+        }
+        sockets[sock.name] = sock;
+        auto svc = services.find(sock.service);
+        if (svc != services.end() && svc->second.pid == 0) arm_sockets(sock.service);
+        return true;
+    }
+
+    // Stop a unit whose file is gone, then forget it
+    void retire_service(const std::string& name) {
+        when_jobs_done({enqueue_job(JobType::STOP, name)}, [this, name](bool) {
+            loop.post([this, name]() {
+                std::lock_guard<std::mutex> lock(services_mutex);
+                auto it = services.find(name);
+                if (it == services.end() || !it->second.removed || it->second.pid != 0 ||
+                    it->second.state == ServiceState::STARTING) {
+                    return;
+                }
+                {
+                    std::lock_guard<std::mutex> jobs_lock(jobs_mutex);
+                    if (unit_jobs.count(name)) return;
+                }
+                services.erase(it);
+                services_changed();
+                std::cout << "[AirRide] Removed " << name << std::endl;
+            });
+        });
+    }
+
+    // Take on an edited definition: at once if the unit is down, else at
+    // its next start. Called with services_mutex held.
+    void redefine_service(Service& svc, const Service& def, std::vector<std::string>& changed,
+                          std::vector<std::string>& pending) {
+        const Service& current = svc.pending ? *svc.pending : svc;
+        if (same_definition(current, def) && !svc.removed) return;
+        
+        if (svc.state == ServiceState::STOPPED || svc.state == ServiceState::FAILED) {
+            apply_definition(svc, def);
+            changed.push_back(def.name);
+        } else if (same_definition(svc, def)) {
+            // Edited and then reverted while running
+            svc.pending.reset();
+            svc.removed = false;
+        } else {
+            svc.pending = std::make_shared<Service>(def);
+            svc.removed = false;
+            pending.push_back(def.name);
+        }
+    }
+
+    // Swap in a new or edited template; its instances are redefined as if
+    // each had its own file. Called with services_mutex held.
+    void update_template(Service def, std::vector<std::string>& added, std::vector<std::string>& changed,
+                         std::vector<std::string>& pending) {
+        auto it = templates.find(def.name);
+        if (it != templates.end() && same_definition(*it->second, def)) return;
+        (it == templates.end() ? added : changed).push_back(def.name);
+        auto tmpl = std::make_shared<const Service>(std::move(def));
+        templates[tmpl->name] = tmpl;
+        for (auto& [name, svc] : services) {
+            Service inst;
+            if (svc.instance_of == tmpl->name && make_instance(*tmpl, name, inst)) {
+                redefine_service(svc, inst, changed, pending);
+            }
+        }
+        create_listed_instances(*tmpl);
+    }
+
+    // Replace a new or edited timer definition, keeping when it last ran;
+    // false if nothing changed
+    bool update_timer(TimerUnit timer) {
+        auto it = timer_units.find(timer.name);
+        if (it != timer_units.end()) {
+            const TimerUnit& old = it->second;
+            if (old.service == timer.service && old.on_calendar == timer.on_calendar &&
+                old.on_boot == timer.on_boot && old.on_active == timer.on_active &&
+                old.randomized_delay == timer.randomized_delay && old.persistent == timer.persistent) {
+                return false;
+            }
+            timer.last_wall = old.last_wall;
+            timer.last_mono = old.last_mono;
+            timer.loaded_mono = old.loaded_mono;
+            timer.generation = old.generation;
+        } else {
+            timer.loaded_mono = monotonic_us();
+        }
+        TimerUnit& t = timer_units[timer.name] = timer;
+        if (timer_units_fd != -1) {
+            schedule_timer(t, realtime_us());
+            arm_timer_units();
+        }
+        return true;
+    }
+
+    void setup_timers() {
+        if (timer_units.empty()) return;
+        // "name<TAB>epoch seconds of the last activation"
+        std::ifstream state(paths.timer_state);
+        std::string name;
+        int64_t last;
+        while (state >> name >> last) {
+            auto it = timer_units.find(name);
+            if (it != timer_units.end()) it->second.last_wall = last;
+        }
+
+        timer_units_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_units_fd == -1) {
+            std::cerr << "[AirRide] Timers unavailable: " << strerror(errno) << std::endl;
+            return;
+        }
+        loop.watch(timer_units_fd, EPOLLIN, [this](uint32_t) { run_timer_units(); });
+        int64_t now = realtime_us();
+        for (auto& [name, timer] : timer_units) schedule_timer(timer, now);
+        arm_timer_units();
+    }
+
+    // Work out the next elapse of `timer` and push it on the heap
+    void schedule_timer(TimerUnit& timer, int64_t now) {
+        int64_t mono_now = monotonic_us();
+        int64_t next = 0;
+        auto consider = [&next](int64_t at) {
+            if (at > 0 && (next == 0 || at < next)) next = at;
+        };
+        // Monotonic deadlines, as wall time for the shared timerfd
+        auto after_mono = [&](int64_t mono) { return now + std::max<int64_t>(0, mono - mono_now); };
+
+        if (!timer.on_calendar.empty()) {
+            int64_t now_sec = now / 1000000;
+            // A persistent timer counts from its last run, even one from a
+            // previous boot; a due run then fires at once
+            int64_t base = timer.persistent && timer.last_wall > 0 ? std::min(timer.last_wall, now_sec) : now_sec;
+            int64_t at = next_calendar_elapse(timer.calendar, base);
+            if (at > 0) consider(std::max(at * 1000000, now));
+        }
+        if (timer.on_boot > 0 && timer.last_mono == 0) {
+            consider(after_mono(init_started + (int64_t)timer.on_boot * 1000000));
+        }
+        if (timer.on_active > 0) {
+            int64_t since = timer.last_mono ? timer.last_mono : timer.loaded_mono ? timer.loaded_mono : init_started;
+            consider(after_mono(since + (int64_t)timer.on_active * 1000000));
+        }
+        if (next > 0 && timer.randomized_delay > 0) {
+            next += std::uniform_int_distribution<int64_t>(0, (int64_t)timer.randomized_delay * 1000000)(timer_rng);
+        }
+
+        timer.next_us = next;
+        timer.generation++;
+        if (next > 0) timer_heap.push({next, timer.name, timer.generation});
+    }
+
+    void arm_timer_units() {
+        // Drop entries for timers that were removed or rescheduled
+        while (!timer_heap.empty()) {
+            auto it = timer_units.find(timer_heap.top().name);
+            if (it != timer_units.end() && it->second.generation == timer_heap.top().generation) break;
+            timer_heap.pop();
+        }
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        if (!timer_heap.empty()) {
+            its.it_value.tv_sec = timer_heap.top().at / 1000000;
+            its.it_value.tv_nsec = timer_heap.top().at % 1000000 * 1000;
+        }
+        timerfd_settime(timer_units_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, nullptr);
+    }
+
+    void run_timer_units() {
+        uint64_t expirations;
+        int64_t now = realtime_us();
+        if (read(timer_units_fd, &expirations, sizeof(expirations)) == -1 && errno == ECANCELED) {
+            // The clock was set: every wall-time deadline is off
+            timer_heap = {};
+            for (auto& [name, timer] : timer_units) schedule_timer(timer, now);
+        }
+
+        bool fired = false;
+        while (!timer_heap.empty() && timer_heap.top().at <= now) {
+            TimerElapse due = timer_heap.top();
+            timer_heap.pop();
+            auto it = timer_units.find(due.name);
+            if (it == timer_units.end() || it->second.generation != due.generation) continue;
+            TimerUnit& timer = it->second;
+            timer.last_wall = now / 1000000;
+            timer.last_mono = monotonic_us();
+            fired = true;
+            schedule_timer(timer, now);
+            activate_timer(timer);
+        }
+        if (fired) save_timer_state();
+        arm_timer_units();
+    }
+
+    void activate_timer(const TimerUnit& timer) {
+        if (shutting_down) return;
+        {
+            std::lock_guard<std::mutex> lock(services_mutex);
+            if (find_or_instantiate(timer.service) == services.end()) {
+                std::cerr << "[AirRide] " << timer.name << ".timer: no service " << timer.service << std::endl;
+                return;
+            }
+        }
+        std::cout << "[AirRide] " << timer.name << ".timer elapsed, starting " << timer.service << std::endl;
+        enqueue_job(JobType::START, timer.service);
+    }
+
+    // Small enough to rewrite on every activation
+    void save_timer_state() {
+        std::stringstream ss;
+        for (const auto& [name, timer] : timer_units) {
+            if (timer.last_wall > 0) ss << name << "\t" << timer.last_wall << "\n";
+        }
+        std::string data = ss.str();
+        std::string dir = paths.timer_state.substr(0, paths.timer_state.rfind('/'));
+        if (!dir.empty()) mkdir(dir.c_str(), 0755);
+        std::string tmp = paths.timer_state + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) return;
+        bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+        close(fd);
+        if (!ok || rename(tmp.c_str(), paths.timer_state.c_str()) == -1) unlink(tmp.c_str());
+    }
+
+    std::string list_timers(bool json) {
+        std::vector<const TimerUnit*> sorted;
+        for (const auto& [name, timer] : timer_units) sorted.push_back(&timer);
+        std::sort(sorted.begin(), sorted.end(), [](const TimerUnit* a, const TimerUnit* b) {
+            if ((a->next_us == 0) != (b->next_us == 0)) return b->next_us == 0;
+            return a->next_us < b->next_us;
+        });
+
+        int64_t now = realtime_us();
+        std::stringstream ss;
+        if (json) ss << "[";
+        else ss << "Timers:\n";
+        for (size_t i = 0; i < sorted.size(); i++) {
+            const TimerUnit& t = *sorted[i];
+            if (json) {
+                ss << (i ? "," : "") << "{\"name\":" << json_string(t.name)
+                   << ",\"service\":" << json_string(t.service)
+                   << ",\"next_usec\":" << t.next_us
+                   << ",\"last_sec\":" << t.last_wall << "}";
+                continue;
+            }
+            ss << "  " << std::left << std::setw(21) << (t.next_us ? format_wall(t.next_us / 1000000) : "-")
+               << std::setw(13) << (t.next_us ? format_us(std::max<int64_t>(0, t.next_us - now)) : "-")
+               << std::setw(21) << (t.last_wall ? format_wall(t.last_wall) : "-")
+               << std::right << t.name << ".timer -> " << t.service << "\n";
+        }
+        if (json) ss << "]\n";
+        return ss.str();
+    }
+
+    void setup_inotify() {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd == -1) return;
+        if (inotify_add_watch(inotify_fd, paths.services.c_str(),
+                              IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB) == -1) {
+            close(inotify_fd);
+            inotify_fd = -1;
+            return;
+        }
+        loop.watch(inotify_fd, EPOLLIN, [this](uint32_t) {
+            char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            while (read(inotify_fd, buffer, sizeof(buffer)) > 0) {}
+            if (reload_armed) return;
+            reload_armed = true;
+            loop.add_timer(RELOAD_DELAY_MS, [this]() {
+                reload_armed = false;
+                reload_services();
+            });
+        });
+    }
+
+    // Replay the list on its own thread when there is one to replay;
+    // true if this boot should record a new list
+    bool setup_readahead() {
+        const std::string& mode = readahead_option;
+        bool replay = mode == "replay";
+        bool record = mode == "record";
+        if (mode == "auto" && getpid() == 1) {
+            // Re-record once the units have changed since the last list
+            struct stat list, dir;
+            replay = stat(paths.readahead.c_str(), &list) == 0;
+            record = !replay || (stat(paths.services.c_str(), &dir) == 0 && dir.st_mtime > list.st_mtime);
+        } else if (!replay && !record && mode != "off" && mode != "auto") {
+            std::cerr << "[AirRide] Bad readahead mode: " << mode << std::endl;
+        }
+
+        if (replay) {
+            std::thread([this]() {
+                int64_t phase_start = monotonic_us();
+                size_t files = 0;
+                uint64_t bytes = 0;
+                if (!replay_readahead_list(files, bytes)) return;
+                record_phase("readahead", phase_start);
+                std::cout << "[AirRide] Readahead: " << files << " files, " << (bytes >> 20) << " MB in "
+                          << (monotonic_us() - phase_start) / 1000 << " ms" << std::endl;
+            }).detach();
+        }
+        return record;
+    }
+
+    // Needs /proc for path lookup, so runs after mount_filesystems()
+    void start_readahead_record() {
+        readahead_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK,
+                                     O_RDONLY | O_LARGEFILE | O_CLOEXEC | O_NOATIME);
+        if (readahead_fd != -1 &&
+            fanotify_mark(readahead_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FAN_OPEN, AT_FDCWD, "/") == -1 &&
+            fanotify_mark(readahead_fd, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_OPEN, AT_FDCWD, "/") == -1) {
+            close(readahead_fd);
+            readahead_fd = -1;
+        }
+        if (readahead_fd == -1) {
+            // Still worth a list built from the services' mappings alone
+            std::cerr << "[AirRide] fanotify unavailable (" << strerror(errno)
+                      << "), recording readahead from process maps" << std::endl;
+            return;
+        }
+        loop.watch(readahead_fd, EPOLLIN, [this](uint32_t) { drain_readahead_events(); });
+        std::cout << "[AirRide] Recording boot readahead" << std::endl;
+    }
+
+    void drain_readahead_events() {
+        char buffer[8192] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+        ssize_t len;
+        while ((len = read(readahead_fd, buffer, sizeof(buffer))) > 0) {
+            auto* event = reinterpret_cast<struct fanotify_event_metadata*>(buffer);
+            for (; FAN_EVENT_OK(event, len); event = FAN_EVENT_NEXT(event, len)) {
+                if (event->fd < 0) continue;
+                // Our own opens are logs, the journal and the unit cache
+                if (event->pid != getpid() && readahead_files.size() < READAHEAD_MAX_FILES) {
+                    char link[64], path[PATH_MAX];
+                    snprintf(link, sizeof(link), "/proc/self/fd/%d", event->fd);
+                    ssize_t n = readlink(link, path, sizeof(path) - 1);
+                    if (n > 0 && path[0] == '/') readahead_files.insert(std::string(path, n));
+                }
+                close(event->fd);
+            }
+        }
+    }
+
+    // Event loop thread, READAHEAD_TAIL_MS after the autostart services
+    // were started
+    void finish_readahead_record() {
+        if (readahead_fd != -1) {
+            drain_readahead_events();
+            loop.unwatch(readahead_fd);
+            close(readahead_fd);
+            readahead_fd = -1;
+        }
+
+        std::vector<pid_t> pids;
+        {
+            std::lock_guard<std::mutex> lock(services_mutex);
+            for (const auto& [name, svc] : services) {
+                if (svc.pid > 0) pids.push_back(svc.pid);
+            }
+        }
+        for (pid_t pid : pids) {
+            std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+            std::string line;
+            while (std::getline(maps, line) && readahead_files.size() < READAHEAD_MAX_FILES) {
+                size_t slash = line.find('/');
+                if (slash != std::string::npos) readahead_files.insert(line.substr(slash));
+            }
+        }
+
+        // Nothing written by AirRide itself is worth prefetching
+        for (const std::string& dir : {paths.logs + "/", paths.readahead}) {
+            auto it = readahead_files.lower_bound(dir);
+            while (it != readahead_files.end() && it->compare(0, dir.size(), dir) == 0) {
+                it = readahead_files.erase(it);
+            }
+        }
+
+        // mincore and FIEMAP over a few thousand files is not loop work
+        std::thread([files = std::move(readahead_files)]() {
+            size_t written = 0;
+            if (write_readahead_list(files, written)) {
+                std::cout << "[AirRide] Recorded readahead for " << written << " files" << std::endl;
+            } else {
+                std::cerr << "[AirRide] Cannot write " << paths.readahead << ": " << strerror(errno) << std::endl;
+            }
+        }).detach();
+        readahead_files.clear();
+    }
+
+    // Listen for uevents; as PID 1 also load the rules and start the
+    // coldplug pass, whose events arrive here like any hotplug
+    void setup_devices() {
+        manage_devices = getpid() == 1;
+        uevent_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+        struct sockaddr_nl addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = 1;  // kernel events
+        if (uevent_fd != -1 && bind(uevent_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            close(uevent_fd);
+            uevent_fd = -1;
+        }
+        if (uevent_fd == -1) {
+            // dev: dependencies fall back to checking that the node exists
+            std::cerr << "[AirRide] No uevent socket: " << strerror(errno) << std::endl;
+            manage_devices = false;
+            return;
+        }
+        int size = UEVENT_RCVBUF;
+        if (setsockopt(uevent_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1) {
+            setsockopt(uevent_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        }
+        loop.watch(uevent_fd, EPOLLIN, [this](uint32_t) { read_uevents(); });
+        if (!manage_devices) return;
+
+        std::ifstream file(paths.devices);
+        if (file) {
+            device_rules = parse_device_rules(file, paths.devices);
+        } else {
+            std::istringstream defaults(DEFAULT_DEVICE_RULES);
+            device_rules = parse_device_rules(defaults, "default device rules");
+        }
+
+        std::thread([this]() {
+            int64_t phase_start = monotonic_us();
+            std::vector<std::string> uevents;
+            collect_uevents("/sys/devices", uevents);
+            std::vector<std::thread> writers;
+            for (int t = 0; t < COLDPLUG_THREADS; t++) {
+                writers.emplace_back([&uevents, t]() {
+                    for (size_t i = t; i < uevents.size(); i += COLDPLUG_THREADS) {
+                        write_file(uevents[i], "add");
+                    }
+                });
+            }
+            for (auto& writer : writers) writer.join();
+            record_phase("coldplug", phase_start);
+            std::cout << "[AirRide] Coldplugged " << uevents.size() << " devices" << std::endl;
+        }).detach();
+    }
+
+    void read_uevents() {
+        char buffer[8192];
+        while (true) {
+            struct sockaddr_nl from;
+            struct iovec iov = {buffer, sizeof(buffer)};
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &from;
+            msg.msg_namelen = sizeof(from);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            ssize_t len = recvmsg(uevent_fd, &msg, 0);
+            if (len < 0) {
+                if (errno == ENOBUFS) {
+                    std::cerr << "[AirRide] uevent queue overflowed, events lost" << std::endl;
+                    continue;
+                }
+                break;
+            }
+            // Only the kernel may speak on this group
+            if (from.nl_pid != 0 || len == 0) continue;
+            handle_uevent(parse_uevent(buffer, len));
+        }
+    }
+
+    void handle_uevent(const std::map<std::string, std::string>& env) {
+        auto get = [&env](const char* key) {
+            auto it = env.find(key);
+            return it != env.end() ? it->second : std::string();
+        };
+        std::string action = get("ACTION");
+        if (manage_devices && action == "add" && !get("MODALIAS").empty()) queue_modalias(get("MODALIAS"));
+
+        std::string name = get("DEVNAME");
+        if (name.empty()) return;
+        std::string path = name[0] == '/' ? name : "/dev/" + name;
+        if (action == "remove") {
+            std::lock_guard<std::mutex> lock(devices_mutex);
+            devices.erase(path);
+            return;
+        }
+        if (action != "add" && action != "change") return;
+        if (manage_devices) apply_device_rules(path, env);
+        if (action == "add") device_added(path);
+    }
+
+    // Create the node if devtmpfs has not, then set mode and owner
+    void apply_device_rules(const std::string& path, const std::map<std::string, std::string>& env) {
+        auto get = [&env](const char* key) {
+            auto it = env.find(key);
+            return it != env.end() ? it->second : std::string();
+        };
+        int major, minor;
+        if (access(path.c_str(), F_OK) == -1 && !get("MAJOR").empty()) {
+            if (!parse_id(get("MAJOR"), major) || !parse_id(get("MINOR"), minor)) {
+                std::cerr << "[AirRide] Bad device number " << get("MAJOR") << ":" << get("MINOR")
+                          << " for " << path << std::endl;
+                return;
+            }
+            for (size_t slash = path.find('/', 5); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+                mkdir(path.substr(0, slash).c_str(), 0755);
+            }
+            mode_t type = get("SUBSYSTEM") == "block" ? S_IFBLK : S_IFCHR;
+            mknod(path.c_str(), type | 0600, makedev(major, minor));
+        }
+
+        std::string name = path.substr(5);
+        std::string subsystem = "subsystem:" + get("SUBSYSTEM");
+        for (const auto& rule : device_rules) {
+            if (rule.match != subsystem && fnmatch(rule.match.c_str(), name.c_str(), FNM_PATHNAME) != 0) continue;
+            chmod(path.c_str(), rule.mode);
+            if (chown(path.c_str(), rule.uid, rule.gid) == -1) {}
+            return;
+        }
+    }
+
+    // A coldplug burst raises many aliases at once; one modprobe takes them all
+    void queue_modalias(const std::string& alias) {
+        if (std::find(modaliases.begin(), modaliases.end(), alias) != modaliases.end()) return;
+        modaliases.push_back(alias);
+        if (modaliases.size() > 1) return;
+        loop.add_timer(MODPROBE_BATCH_MS, [this]() {
+            std::vector<std::string> args = {"modprobe", "-a", "-b", "-q"};
+            args.insert(args.end(), modaliases.begin(), modaliases.end());
+            modaliases.clear();
+            std::vector<char*> argv;
+            for (auto& arg : args) argv.push_back(&arg[0]);
+            argv.push_back(nullptr);
+
+            SpawnRequest req;
+            req.argv = argv.data();
+            req.envp = environ;
+            req.null_fd = ::open("/dev/null", O_RDWR | O_CLOEXEC);
+            if (spawn_process(req) == -1 || req.exec_errno != 0) {
+                std::cerr << "[AirRide] Cannot run modprobe: " << strerror(req.exec_errno ? req.exec_errno : errno)
+                          << std::endl;
+            }
+            if (req.null_fd != -1) close(req.null_fd);
+        });
+    }
+
+    // Call done(true) once `path` is announced, or done(false) after
+    // DEVICE_WAIT_SEC. Any thread.
+    void wait_for_device(const std::string& path, std::function<void(bool)> done) {
+        uint64_t id = 0;
+        bool present;
+        {
+            std::lock_guard<std::mutex> lock(devices_mutex);
+            // Without coldplug an existing node is the best evidence we have
+            present = devices.count(path) > 0 || (!manage_devices && access(path.c_str(), F_OK) == 0);
+            if (!present) {
+                id = next_device_wait++;
+                device_waits[id] = {path, std::move(done)};
+            }
+        }
+        if (present) {
+            done(true);
+            return;
+        }
+        std::cout << "[AirRide] Waiting for " << path << std::endl;
+        loop.post([this, id]() {
+            loop.add_timer(DEVICE_WAIT_SEC * 1000, [this, id]() {
+                std::function<void(bool)> expired;
+                {
+                    std::lock_guard<std::mutex> lock(devices_mutex);
+                    auto it = device_waits.find(id);
+                    if (it == device_waits.end()) return;
+                    std::cerr << "[AirRide] Timed out waiting for " << it->second.path << std::endl;
+                    expired = std::move(it->second.done);
+                    device_waits.erase(it);
+                }
+                expired(false);
+            });
+        });
+    }
+
+    // Event loop thread. Wakes start transactions waiting for the node;
+    // after boot, also starts autostart units that were left down for it.
+    void device_added(const std::string& path) {
+        std::vector<std::function<void(bool)>> ready;
+        {
+            std::lock_guard<std::mutex> lock(devices_mutex);
+            if (!devices.insert(path).second) return;
+            for (auto it = device_waits.begin(); it != device_waits.end();) {
+                if (it->second.path != path) {
+                    ++it;
+                    continue;
+                }
+                ready.push_back(std::move(it->second.done));
+                it = device_waits.erase(it);
+            }
+        }
+        for (auto& done : ready) done(true);
+        if (!boot_done || shutting_down) return;
+
+        std::vector<std::string> units;
+        {
+            std::lock_guard<std::mutex> lock(services_mutex);
+            for (const auto& [name, svc] : services) {
+                if (!svc.autostart || svc.removed || svc.state != ServiceState::STOPPED) continue;
+                bool wants = false;
+                for (const auto& dep : svc.requires) wants = wants || device_node(dep) == path;
+                for (const auto& dep : svc.after) wants = wants || device_node(dep) == path;
+                if (wants) units.push_back(name);
+            }
+        }
+        for (const auto& name : units) {
+            std::cout << "[AirRide] " << path << " appeared, starting " << name << std::endl;
+            enqueue_job(JobType::START, name);
+        }
+    }
+
+    // A unit has settled once it is no longer coming up: notify services
+    // have reported ready (or died), oneshots have run to completion
+    // Called with services_mutex held after any change a waiter or the
+    // published table could care about
+    void services_changed() {
+        services_cv.notify_all();
+        for (auto it = settle_waiters.begin(); it != settle_waiters.end();) {
+            auto svc = services.find(it->first);
+            if (svc != services.end() && !service_settled(svc->second)) {
+                ++it;
+                continue;
+            }
+            // Run outside the lock; the callbacks take it themselves
+            bool ready = svc != services.end() && service_ready(svc->second);
+            start_pool.submit([done = std::move(it->second), ready]() { done(ready); });
+            it = settle_waiters.erase(it);
+        }
+        if (table_dirty.exchange(true)) return;
+        loop.post([this]() {
+            loop.add_timer(TABLE_PUBLISH_MS, [this]() { publish_pending_table(); });
+        });
+    }
+
+    // Event loop thread; retries shortly while a transition holds the lock
+    void publish_pending_table() {
+        if (table_dirty && !publish_service_table()) {
+            loop.add_timer(1, [this]() { publish_pending_table(); });
+        }
+    }
+
+    // Event loop thread. Never waits for services_mutex; false if a
+    // transition holds it right now.
+    bool publish_service_table() {
+        std::unique_lock<std::mutex> lock(services_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) return false;
+        table_dirty = false;
+        auto table = std::make_shared<ServiceTable>();
+        table->services.reserve(services.size());
+        for (auto& [name, svc] : services) {
+            // Only units whose visible state moved get a fresh view
+            const ServiceView* old = svc.view.get();
+            if (old && old->state == svc.state && old->pid == svc.pid && old->failures == svc.failures &&
+                old->changed == (svc.pending != nullptr) && old->status_text == svc.status_text &&
+                old->cgroup == svc.cgroup) {
+                table->services.push_back(svc.view);
+                continue;
+            }
+            auto view = std::make_shared<ServiceView>();
+            ServiceView& v = *view;
+            v.name = svc.name;
+            v.description = svc.description;
+            v.type = svc.type;
+            v.state = svc.state;
+            v.pid = svc.pid;
+            v.autostart = svc.autostart;
+            v.socket = has_sockets(name);
+            v.changed = svc.pending != nullptr;
+            v.failures = svc.failures;
+            v.tty_device = svc.tty_device;
+            v.status_text = svc.status_text;
+            v.cgroup = svc.cgroup;
+            v.attrs = svc.attrs;
+            svc.view = view;
+            table->services.push_back(std::move(view));
+        }
+        lock.unlock();
+        table->version = ++table_version;
+        std::atomic_store(&service_table, std::shared_ptr<const ServiceTable>(std::move(table)));
+        return true;
+    }
+
+    // Event loop thread. Brings the copy up to date first if that can be
+    // done without waiting, else serves the last published one.
+    std::shared_ptr<const ServiceTable> current_table() {
+        if (table_dirty) publish_service_table();
+        return std::atomic_load(&service_table);
+    }
+
+    static bool service_settled(const Service& svc) {
+        if (svc.state == ServiceState::STARTING) return false;
+        if (svc.type == ServiceType::ONESHOT && svc.pid != 0) return false;
+        return true;
+    }
+
+    static bool service_ready(const Service& svc) {
+        if (svc.state == ServiceState::RUNNING) return true;
+        return svc.type == ServiceType::ONESHOT && svc.state == ServiceState::STOPPED;
+    }
+
+    // Block until `name` settles; timeout_sec <= 0 waits indefinitely.
+    // Returns whether the unit ended up ready.
+    bool wait_for_service(const std::string& name, int timeout_sec = 30) {
+        std::unique_lock<std::mutex> lock(services_mutex);
+        auto it = services.find(name);
+        if (it == services.end()) return false;
+        
+        Service& svc = it->second;
+        auto settled = [&svc] { return service_settled(svc); };
+        if (timeout_sec > 0) {
+            services_cv.wait_for(lock, std::chrono::seconds(timeout_sec), settled);
+        } else {
+            services_cv.wait(lock, settled);
+        }
+        return service_ready(svc);
+    }
+
+    // Call `done` with whether `name` ended up ready once it settles,
+    // without parking a thread in the meantime
+    void when_settled(const std::string& name, std::function<void(bool)> done) {
+        bool ready;
+        {
+            std::lock_guard<std::mutex> lock(services_mutex);
+            auto it = services.find(name);
+            if (it != services.end() && !service_settled(it->second)) {
+                settle_waiters.emplace(name, std::move(done));
+                return;
+            }
+            ready = it != services.end() && service_ready(it->second);
+        }
+        done(ready);
+    }
+
+    // Enable the resource controllers for our subtree. Services get one
+    // cgroup each below paths.cgroup; without cgroup2 they run unconfined.
+    // A test-mode instance never falls back to CGROUP_DIR: recreating a
+    // service's group there would kill the live init's copy of it.
+    void setup_cgroups() {
+        if (paths.cgroup.empty()) {
+            if (getpid() != 1) {
+                std::cout << "[AirRide] No --cgroup given, services run without resource control" << std::endl;
+                return;
+            }
+            paths.cgroup = CGROUP_DIR;
+        }
+        while (paths.cgroup.size() > 1 && paths.cgroup.back() == '/') paths.cgroup.pop_back();
+        cgroup_created = mkdir(paths.cgroup.c_str(), 0755) == 0;
+        // Controllers come down from the group we were given, not the root
+        std::string parent = paths.cgroup.substr(0, paths.cgroup.find_last_of('/'));
+        if (parent.empty()) parent = "/";
+        std::istringstream available(read_file(parent + "/cgroup.controllers"));
+        std::string controller;
+        while (available >> controller) {
+            if (controller != "cpu" && controller != "memory" && controller != "io" && controller != "pids") continue;
+            write_file(parent + "/cgroup.subtree_control", "+" + controller);
+            write_file(paths.cgroup + "/cgroup.subtree_control", "+" + controller);
+        }
+        cgroups = access((paths.cgroup + "/cgroup.procs").c_str(), W_OK) == 0;
+        if (!cgroups) {
+            std::cerr << "[AirRide] cgroup2 unavailable, services run without resource control" << std::endl;
+        }
+    }
+
+    // Fresh cgroup for a new run, with the unit's limits applied
+    std::string prepare_cgroup(const Service& svc) {
+        if (!cgroups) return "";
+        std::string path = paths.cgroup + "/" + svc.name;
+        
+        // Leftovers from the previous run die first; the empty group is
+        // then recreated so accounting starts from zero
+        kill_cgroup(path);
+        rmdir(path.c_str());
+        if (mkdir(path.c_str(), 0755) == -1 && errno != EEXIST) return "";
+        
+        for (const auto& [file, value] : svc.cgroup_limits) {
+            if (!write_file(path + "/" + file, value)) {
+                std::cerr << "[AirRide] " << svc.name << ": cannot set " << file
+                          << "=" << value << ": " << strerror(errno) << std::endl;
+            }
+        }
+        return path;
+    }
+
+    // Test mode leaves the host as it found it. Services are stopped by
+    // now; groups that still hold a straggler stay behind.
+    void remove_cgroups() {
+        if (!cgroups) return;
+        std::lock_guard<std::mutex> lock(services_mutex);
+        for (const auto& [name, svc] : services) rmdir((paths.cgroup + "/" + name).c_str());
+        if (cgroup_created) rmdir(paths.cgroup.c_str());
+    }
+
+    // SIGKILL every process in the group at once (Linux 5.14+)
+    static bool kill_cgroup(const std::string& path) {
+        if (path.empty()) return false;
+        return write_file(path + "/cgroup.kill", "1");
+    }
+
+    struct CgroupStats {
+        bool valid = false, has_memory = false, has_io = false;
+        uint64_t cpu_usec = 0, user_usec = 0, system_usec = 0;
+        uint64_t memory = 0, memory_peak = 0;
+        uint64_t io_read = 0, io_written = 0;
+        uint64_t tasks = 0;
+    };
+
+    static CgroupStats cgroup_stats(const std::string& path) {
+        CgroupStats st;
+        if (path.empty()) return st;
+        
+        std::istringstream cpu(read_file(path + "/cpu.stat"));
+        std::string key;
+        uint64_t value;
+        while (cpu >> key >> value) {
+            st.valid = true;
+            if (key == "usage_usec") st.cpu_usec = value;
+            else if (key == "user_usec") st.user_usec = value;
+            else if (key == "system_usec") st.system_usec = value;
+        }
+        
+        std::string memory = read_file(path + "/memory.current");
+        st.has_memory = !memory.empty();
+        st.memory = strtoull(memory.c_str(), nullptr, 10);
+        st.memory_peak = strtoull(read_file(path + "/memory.peak").c_str(), nullptr, 10);
+        st.tasks = strtoull(read_file(path + "/pids.current").c_str(), nullptr, 10);
+        
+        // "<maj>:<min> rbytes=N wbytes=N rios=N ..." per device
+        st.has_io = access((path + "/io.stat").c_str(), R_OK) == 0;
+        std::istringstream io(read_file(path + "/io.stat"));
+        std::string field;
+        while (io >> field) {
+            if (field.rfind("rbytes=", 0) == 0) st.io_read += strtoull(field.c_str() + 7, nullptr, 10);
+            else if (field.rfind("wbytes=", 0) == 0) st.io_written += strtoull(field.c_str() + 7, nullptr, 10);
+        }
+        return st;
+    }
+
+    // Launch a single service. Ordering is the scheduler's job; the only
+    // waiting done here is for 'after' units another start is bringing up.
+    bool start_service_internal(const std::string& name) {
+        Service* svc = nullptr;
+        std::vector<std::string> in_flight;
+        {
+            std::lock_guard<std::mutex> lock(services_mutex);
+            auto it = services.find(name);
+            if (it == services.end()) {
+                std::cerr << "[AirRide] Service not found: " << name << std::endl;
+                return false;
+            }
+            svc = &it->second;
+            
+            if (svc->state == ServiceState::RUNNING) return true;
+            if (svc->state == ServiceState::STARTING) return true;
+            if (svc->removed || shutting_down) return false;
+            if (svc->pending) {
+                std::cout << "[AirRide] Applying new definition of " << name << std::endl;
+                apply_definition(*svc, *svc->pending);
+            }
+            
+            svc->state = ServiceState::STARTING;
+            services_changed();
+            
+            for (const auto& dep : svc->after) {
+                auto dit = services.find(dep);
+                if (dit != services.end() && !service_settled(dit->second)) {
+                    in_flight.push_back(dep);
+                }
+            }
+        }
+
+        for (const auto& dep : in_flight) {
+            wait_for_service(dep, 10);
+        }
+
+        std::cout << "[AirRide] Starting " << svc->name;
+        if (!svc->tty_device.empty()) {
+            std::cout << " on " << svc->tty_device;
+        }
+        std::cout << std::endl;
+
+        // Readiness pipe: the service writes "READY=1" to $NOTIFY_FD
+        int notify_pipe[2] = {-1, -1};
+        if (svc->type == ServiceType::NOTIFY && pipe2(notify_pipe, O_CLOEXEC) == -1) {
+            std::cerr << "[AirRide] Cannot create readiness pipe for " << svc->name << std::endl;
+            std::lock_guard<std::mutex> lock(services_mutex);
+            svc->state = ServiceState::FAILED;
+            services_changed();
+            return false;
+        }
+
+        // Background output goes through a pipe drained by the event loop
+        int log_pipe[2] = {-1, -1};
+        if (svc->tty_device.empty() && !svc->foreground) pipe2(log_pipe, O_CLOEXEC);
+
+        std::string cgroup = prepare_cgroup(*svc);
+
+        // Gathered under the lock, but the clone runs without it: with
+        // CLONE_VFORK we are held until the child has exec'd, which from a
+        // cold disk can take a while. A STARTING unit keeps its definition,
+        // so svc's strings stay put; listeners are duplicated in case a
+        // reload closes them in the meantime.
+        SpawnRequest req;
+        std::vector<char*> argv, envp;
+        std::vector<std::string> extra_env;
+        std::string fd_names;
+        std::shared_ptr<const std::vector<std::string>> environment;
+        {
+            std::lock_guard<std::mutex> lock(services_mutex);
+            for (const auto& [sname, sock] : sockets) {
+                if (sock.service != svc->name) continue;
+                for (const auto& l : sock.listeners) {
+                    if (l.fd == -1 || req.listen_count == SOCKET_MAX_FDS) continue;
+                    int fd = fcntl(l.fd, F_DUPFD_CLOEXEC, 0);
+                    if (fd == -1) continue;
+                    req.listen_fds[req.listen_count++] = fd;
+                    fd_names += (fd_names.empty() ? "" : ":") + sname;
+                }
+            }
+            environment = svc->envp;
+            svc->cgroup = cgroup;
+            svc->spawning = true;
+            spawns_in_flight++;
+        }
+        if (req.listen_count > 0) {
+            extra_env.push_back("LISTEN_FDS=" + std::to_string(req.listen_count));
+            extra_env.push_back("LISTEN_FDNAMES=" + fd_names);
+            envp.push_back(req.listen_pid);
+        }
+        if (svc->type == ServiceType::NOTIFY) {
+            extra_env.push_back("NOTIFY_FD=" + std::to_string(NOTIFY_FD + req.listen_count));
+        }
+        
+        // Ours first: getenv() returns the first match
+        for (const auto& entry : extra_env) envp.push_back(const_cast<char*>(entry.c_str()));
+        for (const auto& arg : svc->argv) argv.push_back(const_cast<char*>(arg.c_str()));
+        for (const auto& entry : *environment) envp.push_back(const_cast<char*>(entry.c_str()));
+        argv.push_back(nullptr);
+        envp.push_back(nullptr);
+        req.argv = argv.data();
+        req.envp = envp.data();
+        
+        if (!svc->tty_device.empty()) {
+            req.tty = svc->tty_device.c_str();
+        } else if (svc->foreground) {
+            req.tty = "/dev/console";
+        } else {
+            req.null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+            req.out_fd = log_pipe[1];
+        }
+        req.notify_fd = notify_pipe[1];
+        if (!cgroup.empty()) req.cgroup_fd = open((cgroup + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+        req.attrs = &svc->attrs;
+        if (svc->attrs.oom_score_adjust != ATTR_UNSET) {
+            snprintf(req.oom_score_adj, sizeof(req.oom_score_adj), "%d", svc->attrs.oom_score_adjust);
+        }
+        pid_t pid = spawn_process(req);
+        int spawn_errno = errno;
+        
+        if (req.null_fd != -1) close(req.null_fd);
+        if (req.cgroup_fd != -1) close(req.cgroup_fd);
+        if (notify_pipe[1] != -1) close(notify_pipe[1]);
+        if (log_pipe[1] != -1) close(log_pipe[1]);
+        for (int i = 0; i < req.listen_count; i++) close(req.listen_fds[i]);
+        
+        std::unique_lock<std::mutex> lock(services_mutex);
+        // The reaper may already have collected a child that died at once
+        auto early = early_exits.find(pid);
+        bool exited_early = pid > 0 && early != early_exits.end();
+        int early_status = exited_early ? early->second : 0;
+        if (exited_early) early_exits.erase(early);
+        if (--spawns_in_flight == 0) early_exits.clear();
+        svc->spawning = false;
+        
+        // The child has already exec'd (or failed to) by the time we run;
+        // one that never got to exec has exited, and the reaper collects
+        // it without us
+        if (pid > 0 && (req.failed_step || req.exec_errno)) {
+            if (req.failed_step) {
+                std::cerr << "[AirRide] Cannot set " << req.failed_step << " for " << svc->name
+                          << ": " << strerror(req.exec_errno) << std::endl;
+            } else {
+                std::cerr << "[AirRide] Cannot execute " << svc->name << ": "
+                          << strerror(req.exec_errno) << std::endl;
+            }
+            if (notify_pipe[0] != -1) close(notify_pipe[0]);
+            if (log_pipe[0] != -1) close(log_pipe[0]);
+            svc->timeline.forked = svc->timeline.exited = monotonic_us();
+            svc->timeline.exec = svc->timeline.ready = 0;
+            svc->state = ServiceState::FAILED;
+            services_changed();
+            return false;
+        }
+        
+        if (pid > 0) {
+            svc->pid = pid;
+            pid_index[pid] = svc;
+            if (req.listen_count > 0) {
+                // The service owns its sockets now; stop watching them
+                std::string name = svc->name;
+                loop.post([this, name, pid]() {
+                    std::lock_guard<std::mutex> lock(services_mutex);
+                    auto it = services.find(name);
+                    if (it != services.end() && it->second.pid == pid) disarm_sockets(name);
+                });
+            }
+            if (log_pipe[0] != -1) attach_log_pipe(*svc, log_pipe[0]);
+            if (exited_early) {
+                // Handled on the loop thread once we let go of the lock
+                loop.post([this, pid, early_status]() { handle_child_exit(pid, early_status); });
+            } else {
+                track_pidfd(svc, pid);
+            }
+            svc->status_text.clear();
+            svc->timeline.forked = monotonic_us();
+            svc->timeline.exec = svc->timeline.forked;
+            svc->timeline.ready = svc->timeline.exited = 0;
+            
+            if (svc->type == ServiceType::NOTIFY) {
+                // Stays STARTING until the service reports ready
+                svc->notify_fd = notify_pipe[0];
+                watch_readiness(svc->name, pid, notify_pipe[0], svc->ready_timeout);
+                services_changed();
+                return true;
+            }
+            
+            // A oneshot settles when the reaper collects it
+            svc->state = ServiceState::RUNNING;
+            if (svc->type != ServiceType::ONESHOT) svc->timeline.ready = svc->timeline.exec;
+            services_changed();
+            return true;
+        }
+        
+        std::cerr << "[AirRide] Cannot spawn " << svc->name << ": " << strerror(spawn_errno) << std::endl;
+        if (notify_pipe[0] != -1) close(notify_pipe[0]);
+        if (log_pipe[0] != -1) close(log_pipe[0]);
+        svc->state = ServiceState::FAILED;
+        services_changed();
+        return false;
+    }
+
+    // Hand a service's output pipe to the event loop. Called with
+    // services_mutex held, from any thread.
+    void attach_log_pipe(const Service& svc, int fd) {
+        std::string name = svc.name;
+        pid_t pid = svc.pid;
+        size_t max_size = svc.log_max_size;
+        int max_files = svc.log_max_files;
+        int max_age = svc.log_max_age;
+        
+        loop.post([this, name, pid, fd, max_size, max_files, max_age]() {
+            LogStream& stream = log_streams[name];
+            stream.max_size = max_size;
+            stream.max_files = max_files;
+            stream.max_age = max_age;
+            
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+            auto partial = std::make_shared<std::string>();
+            loop.watch(fd, EPOLLIN, [this, name, pid, fd, partial](uint32_t) {
+                drain_log_pipe(name, pid, fd, *partial);
+            });
+        });
+    }
+
+    // `partial` carries an unterminated line between reads for the journal
+    void drain_log_pipe(const std::string& name, pid_t pid, int fd, std::string& partial) {
+        LogStream& stream = log_streams[name];
+        char buffer[8192];
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+            stream.ring.append(buffer, n);
+            stream.pending.append(buffer, n);
+            journal_lines(name, pid, partial, buffer, n);
+            
+            // Followers that cannot keep up are dropped, never waited on
+            for (size_t i = 0; i < stream.followers.size();) {
+                auto& [conn, id] = stream.followers[i];
+                if (conn->queued() > CONTROL_HIGH_WATER || !conn->send_data(id, std::string(buffer, n))) {
+                    conn->send_end(id, true);
+                    stream.followers.erase(stream.followers.begin() + i);
+                } else {
+                    i++;
+                }
+            }
+        }
+        
+        bool eof = n == 0 || (n == -1 && errno != EAGAIN);
+        if (eof) {
+            loop.unwatch(fd);
+            close(fd);
+            if (!partial.empty()) {
+                journal.append(name, pid, realtime_us(), partial.data(), partial.size());
+                partial.clear();
+            }
+        }
+        schedule_journal_flush();
+
+        if (stream.pending.size() >= LOG_FLUSH_BYTES || eof) {
+            flush_log(name, stream);
+        } else if (!stream.pending.empty() && !stream.flush_armed) {
+            stream.flush_armed = true;
+            loop.add_timer(LOG_FLUSH_MS, [this, name]() {
+                LogStream& s = log_streams[name];
+                s.flush_armed = false;
+                flush_log(name, s);
+            });
+        }
+    }
+
+    void journal_lines(const std::string& name, pid_t pid, std::string& partial,
+                       const char* data, size_t len) {
+        int64_t now = realtime_us();
+        const char* end = data + len;
+        while (data < end) {
+            const char* nl = (const char*)memchr(data, '\n', end - data);
+            if (!nl) {
+                partial.append(data, end - data);
+                // Never let one unterminated line grow without bound
+                if (partial.size() >= LOG_FLUSH_BYTES) {
+                    journal.append(name, pid, now, partial.data(), partial.size());
+                    partial.clear();
+                }
+                return;
+            }
+            if (partial.empty()) {
+                journal.append(name, pid, now, data, nl - data);
+            } else {
+                partial.append(data, nl - data);
+                journal.append(name, pid, now, partial.data(), partial.size());
+                partial.clear();
+            }
+            data = nl + 1;
+        }
+    }
+
+    void schedule_journal_flush() {
+        if (journal.pending_bytes() >= LOG_FLUSH_BYTES) {
+            journal.flush();
+        } else if (journal.pending_bytes() > 0 && !journal_flush_armed) {
+            journal_flush_armed = true;
+            loop.add_timer(LOG_FLUSH_MS, [this]() {
+                journal_flush_armed = false;
+                journal.flush();
+            });
+        }
+    }
+
+    // `journal since=<us> until=<us> service=<name>`: indexed history query.
+    // The scan runs on its own thread so large histories never stall PID 1.
+    void serve_journal(std::shared_ptr<ControlConnection> conn, uint32_t id,
+                       const std::vector<std::string>& args) {
+        JournalQuery q;
+        for (size_t i = 1; i < args.size(); i++) {
+            size_t eq = args[i].find('=');
+            if (eq == std::string::npos) continue;
+            std::string key = args[i].substr(0, eq), value = args[i].substr(eq + 1);
+            if (key == "since" || key == "until") {
+                char* end;
+                errno = 0;
+                long long us = strtoll(value.c_str(), &end, 10);
+                if (value.empty() || *end != '\0' || errno == ERANGE) {
+                    conn->reply(id, "Invalid time: " + value + "\n", true);
+                    return;
+                }
+                (key == "since" ? q.since : q.until) = us;
+            }
+            else if (key == "service") q.service = value;
+        }
+        
+        auto snap = std::make_shared<Journal::Snapshot>(journal.snapshot());
+        std::thread([conn, id, snap, q]() {
+            std::string chunk;
+            Journal::query(*snap, q, [&](const std::string& line) {
+                chunk += line;
+                if (chunk.size() < CONTROL_CHUNK) return true;
+                bool ok = conn->wait_writable() && conn->send_data(id, chunk);
+                chunk.clear();
+                return ok;
+            });
+            conn->reply(id, chunk);
+        }).detach();
+    }
+
+    std::string log_path(const std::string& name, int generation = 0) {
+        std::string path = paths.logs + "/" + name + ".log";
+        return generation ? path + "." + std::to_string(generation) : path;
+    }
+
+    void flush_log(const std::string& name, LogStream& stream) {
+        if (stream.pending.empty()) return;
+        
+        bool too_big = stream.max_size && stream.file_size + stream.pending.size() > stream.max_size;
+        bool too_old = stream.max_age && stream.file_size > 0 &&
+                       monotonic_us() - stream.opened_at > (int64_t)stream.max_age * 1000000;
+        if (stream.file_fd != -1 && (too_big || too_old)) rotate_log(name, stream);
+        
+        if (stream.file_fd == -1) {
+            mkdir(paths.logs.c_str(), 0755);
+            stream.file_fd = open(log_path(name).c_str(),
+                                  O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (stream.file_fd == -1) {
+                // Nowhere to write; the ring still has the tail
+                stream.pending.clear();
+                return;
+            }
+            struct stat st;
+            stream.file_size = fstat(stream.file_fd, &st) == 0 ? st.st_size : 0;
+            stream.opened_at = monotonic_us();
+            if (stream.max_size && stream.file_size + stream.pending.size() > stream.max_size &&
+                stream.file_size > 0) {
+                rotate_log(name, stream);
+                if (stream.file_fd == -1) return;
+            }
+        }
+
+        ssize_t n = write(stream.file_fd, stream.pending.data(), stream.pending.size());
+        if (n > 0) stream.file_size += n;
+        stream.pending.clear();
+    }
+
+    // <name>.log -> <name>.log.1 -> ... -> <name>.log.<max_files>, oldest dropped
+    void rotate_log(const std::string& name, LogStream& stream) {
+        close(stream.file_fd);
+        stream.file_fd = -1;
+        
+        if (stream.max_files <= 0) {
+            unlink(log_path(name).c_str());
+        } else {
+            unlink(log_path(name, stream.max_files).c_str());
+            for (int gen = stream.max_files - 1; gen >= 0; gen--) {
+                rename(log_path(name, gen).c_str(), log_path(name, gen + 1).c_str());
+            }
+        }
+        
+        stream.file_fd = open(log_path(name).c_str(),
+                              O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        stream.file_size = 0;
+        stream.opened_at = monotonic_us();
+    }
+
+    // `logs <svc> [-f]`: send the ring, then optionally keep streaming
+    void serve_logs(std::shared_ptr<ControlConnection> conn, uint32_t id,
+                    const std::string& name, bool follow) {
+        {
+            std::lock_guard<std::mutex> lock(services_mutex);
+            if (!services.count(name)) {
+                conn->reply(id, "Service not found\n", true);
+                return;
+            }
+        }
+        
+        LogStream& stream = log_streams[name];
+        std::string tail = stream.ring.contents();
+        if (!follow) {
+            conn->reply(id, tail);
+            return;
+        }
+        if (conn->send_data(id, tail)) stream.followers.push_back({conn, id});
+    }
+
+    // Register a notify service's readiness pipe with the event loop and
+    // arm its ready_timeout. Safe to call from any thread.
+    void watch_readiness(const std::string& name, pid_t pid, int fd, int timeout_sec) {
+        loop.post([this, name, pid, fd, timeout_sec]() {
+            auto pending = std::make_shared<std::string>();
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+            loop.watch(fd, EPOLLIN, [this, name, fd, pending](uint32_t) {
+                char buffer[512];
+                ssize_t n;
+                while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+                    pending->append(buffer, n);
+                }
+                
+                size_t nl;
+                while ((nl = pending->find('\n')) != std::string::npos) {
+                    std::string line = pending->substr(0, nl);
+                    pending->erase(0, nl + 1);
+                    handle_notify_line(name, line);
+                }
+                
+                if (n == 0 || (n == -1 && errno != EAGAIN)) {
+                    loop.unwatch(fd);
+                    close(fd);
+                    std::lock_guard<std::mutex> lock(services_mutex);
+                    auto it = services.find(name);
+                    if (it != services.end() && it->second.notify_fd == fd) it->second.notify_fd = -1;
+                }
+            });
+
+            if (timeout_sec <= 0) return;
+            loop.add_timer(timeout_sec * 1000, [this, name, pid, timeout_sec]() {
+                std::lock_guard<std::mutex> lock(services_mutex);
+                auto it = services.find(name);
+                if (it == services.end()) return;
+                Service& svc = it->second;
+                if (svc.pid != pid || svc.state != ServiceState::STARTING) return;
+                
+                std::cerr << "[AirRide] " << name << " did not report ready within "
+                          << timeout_sec << "s" << std::endl;
+                svc.state = ServiceState::FAILED;
+                services_changed();
+                kill(pid, SIGTERM);
+            });
+        });
+    }
+
+    void handle_notify_line(const std::string& name, const std::string& line) {
+        std::lock_guard<std::mutex> lock(services_mutex);
+        auto it = services.find(name);
+        if (it == services.end()) return;
+        Service& svc = it->second;
+        
+        // A bare newline is accepted as readiness too (s6 convention)
+        if (line == "READY=1" || line.empty()) {
+            if (svc.state == ServiceState::STARTING) {
+                svc.state = ServiceState::RUNNING;
+                svc.timeline.ready = monotonic_us();
+                services_changed();
+                std::cout << "[AirRide] " << name << " ready" << std::endl;
+            }
+        } else if (line.compare(0, 7, "STATUS=") == 0) {
+            svc.status_text = line.substr(7);
+            services_changed();
+        }
+    }
+
+    bool start_service(const std::string& name) {
+        return start_services({name});
+    }
+
+    // start_services_async() for callers that can wait. Returns whether
+    // every root came up; `results` gets one entry per root.
+    bool start_services(const std::vector<std::string>& roots, bool boot = false,
+                        std::vector<bool>* results = nullptr) {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool finished = false;
+        std::vector<bool> ok;
+        start_services_async(roots, boot, [&](std::vector<bool> started) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ok = std::move(started);
+            finished = true;
+            cv.notify_all();
+        });
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return finished; });
+        if (results) *results = ok;
+        return std::find(ok.begin(), ok.end(), false) == ok.end();
+    }
+
+    // Build the requires/after graph for `roots` plus everything they
+    // require, then launch each unit on the worker pool as soon as its
+    // predecessors have settled. Nothing waits on the set: `done` gets
+    // one result per root from whichever thread settles the last unit.
+    void start_services_async(const std::vector<std::string>& roots, bool boot,
+                              std::function<void(std::vector<bool>)> done) {
+        // settle and dispatch hold a plain pointer, so the transaction is
+        // owned only by the launches and device waits still outstanding
+        struct Transaction : std::enable_shared_from_this<Transaction> {
+            std::mutex mutex;
+            std::vector<StartNode> nodes;
+            size_t remaining = 0;
+            bool serial_busy = false;
+            std::deque<size_t> serial_waiting;
+            bool boot = false;
+            bool console_cleared = false;
+            std::vector<size_t> roots;  // node of each root
+            std::function<void(size_t, bool)> settle;
+            std::function<void(size_t)> dispatch;
+            std::function<void(std::vector<bool>)> done;
+        };
+        auto tx = std::make_shared<Transaction>();
+        tx->boot = boot;
+        tx->done = std::move(done);
+        std::map<std::string, size_t> index;
+
+        {
+            std::lock_guard<std::mutex> lock(services_mutex);
+            std::vector<std::string> stack(roots.rbegin(), roots.rend());
+            while (!stack.empty()) {
+                std::string name = stack.back();
+                stack.pop_back();
+                if (index.count(name)) continue;
+
+                index[name] = tx->nodes.size();
+                StartNode node;
+                node.name = name;
+                auto it = find_or_instantiate(name);
+                if (!device_node(name).empty()) {
+                    node.device = true;
+                } else if (it == services.end()) {
+                    node.missing = true;
+                } else {
+                    if (service_settled(it->second)) {
+                        it->second.timeline = ServiceTimeline();
+                        it->second.timeline.queued = monotonic_us();
+                    }
+                    node.serial = !it->second.parallel;
+                    node.tty = !it->second.tty_device.empty() || it->second.foreground;
+                    for (const auto& dep : it->second.requires) stack.push_back(dep);
+                    for (const auto& dep : it->second.after) {
+                        if (!device_node(dep).empty()) stack.push_back(dep);
+                    }
+                }
+                tx->nodes.push_back(node);
+            }
+
+            auto add_edge = [&](size_t from, size_t to, bool hard) {
+                tx->nodes[from].dependents.push_back({to, hard});
+                tx->nodes[to].pending++;
+            };
+            for (size_t i = 0; i < tx->nodes.size(); i++) {
+                auto it = services.find(tx->nodes[i].name);
+                if (it == services.end()) continue;
+                for (const auto& dep : it->second.requires) {
+                    add_edge(index[dep], i, true);
+                }
+                for (const auto& dep : it->second.after) {
+                    auto dit = index.find(dep);
+                    if (dit != index.end() && dit->second != i) add_edge(dit->second, i, false);
+                }
+            }
+
+            // At boot, login prompts wait for everything else so that
+            // progress output does not land on top of them. A unit already
+            // ordered after the prompt keeps that order; the edge added
+            // the other way would be a cycle.
+            if (boot) {
+                for (size_t i = 0; i < tx->nodes.size(); i++) {
+                    if (!tx->nodes[i].tty) continue;
+                    std::vector<bool> after_tty(tx->nodes.size(), false);
+                    std::vector<size_t> stack = {i};
+                    while (!stack.empty()) {
+                        size_t n = stack.back();
+                        stack.pop_back();
+                        for (const auto& [d, hard] : tx->nodes[n].dependents) {
+                            if (!after_tty[d]) {
+                                after_tty[d] = true;
+                                stack.push_back(d);
+                            }
+                        }
+                    }
+                    for (size_t j = 0; j < tx->nodes.size(); j++) {
+                        if (!tx->nodes[j].tty && !tx->nodes[j].device && !after_tty[j]) add_edge(j, i, false);
+                    }
+                }
+            }
+        }
+
+        // Kahn's algorithm on a copy of the in-degrees to find cycles
+        std::vector<size_t> indegree;
+        std::vector<size_t> queue;
+        for (size_t i = 0; i < tx->nodes.size(); i++) {
+            indegree.push_back(tx->nodes[i].pending);
+            if (tx->nodes[i].pending == 0) queue.push_back(i);
+        }
+        for (size_t q = 0; q < queue.size(); q++) {
+            for (const auto& [d, hard] : tx->nodes[queue[q]].dependents) {
+                if (--indegree[d] == 0) queue.push_back(d);
+            }
+        }
+        if (queue.size() != tx->nodes.size()) {
+            // Left over are the cycles and everything ordered behind them.
+            // Only nodes that reach themselves are on a cycle; they fail
+            // without starting, and the rest of the set goes ahead, with
+            // hard dependents of the cycle failing as usual.
+            std::string members;
+            for (size_t i = 0; i < tx->nodes.size(); i++) {
+                if (indegree[i] == 0) continue;
+                std::vector<bool> seen(tx->nodes.size(), false);
+                std::vector<size_t> stack = {i};
+                while (!stack.empty() && !tx->nodes[i].cyclic) {
+                    size_t n = stack.back();
+                    stack.pop_back();
+                    for (const auto& [d, hard] : tx->nodes[n].dependents) {
+                        if (d == i) tx->nodes[i].cyclic = true;
+                        if (indegree[d] > 0 && !seen[d]) {
+                            seen[d] = true;
+                            stack.push_back(d);
+                        }
+                    }
+                }
+                if (tx->nodes[i].cyclic) members += " " + tx->nodes[i].name;
+            }
+            std::cerr << "[AirRide] Dependency cycle among:" << members << std::endl;
+
+            std::lock_guard<std::mutex> lock(services_mutex);
+            for (auto& node : tx->nodes) {
+                if (!node.cyclic) continue;
+                node.pending = 0;
+                auto it = services.find(node.name);
+                if (it != services.end() && it->second.state == ServiceState::STOPPED) {
+                    it->second.state = ServiceState::FAILED;
+                }
+            }
+            services_changed();
+        }
+
+        for (const auto& root : roots) tx->roots.push_back(index[root]);
+        tx->remaining = tx->nodes.size();
+        if (tx->nodes.empty()) {
+            tx->done({});
+            return;
+        }
+
+        Transaction* t = tx.get();
+        t->settle = [this, t](size_t i, bool ok) {
+            std::vector<size_t> ready;
+            {
+                std::lock_guard<std::mutex> lock(t->mutex);
+                StartNode& node = t->nodes[i];
+                node.ok = ok;
+                if (node.serial && !node.missing && !node.dep_failed && !node.cyclic) {
+                    t->serial_busy = false;
+                    if (!t->serial_waiting.empty()) {
+                        ready.push_back(t->serial_waiting.front());
+                        t->serial_waiting.pop_front();
+                    }
+                }
+                for (const auto& [d, hard] : node.dependents) {
+                    // Cycle members were dispatched up front
+                    if (t->nodes[d].cyclic) continue;
+                    if (hard && !ok) t->nodes[d].dep_failed = true;
+                    if (--t->nodes[d].pending == 0) {
+                        t->nodes[d].waited_on = node.name;
+                        ready.push_back(d);
+                    }
+                }
+            }
+            for (size_t d : ready) t->dispatch(d);
+
+            std::vector<bool> results;
+            {
+                std::lock_guard<std::mutex> lock(t->mutex);
+                --t->remaining;
+                if (t->boot && console.is_quiet()) {
+                    console.progress("[AirRide] Starting services: " + std::to_string(t->nodes.size() - t->remaining) +
+                                     "/" + std::to_string(t->nodes.size()));
+                }
+                if (t->remaining > 0) return;
+                for (size_t root : t->roots) results.push_back(t->nodes[root].ok);
+            }
+            t->done(std::move(results));
+        };
+
+        t->dispatch = [this, t](size_t i) {
+            StartNode& node = t->nodes[i];
+            if (node.cyclic) {
+                t->settle(i, false);
+                return;
+            }
+            if (node.missing || node.dep_failed) {
+                if (node.missing) {
+                    std::cerr << "[AirRide] Service not found: " << node.name << std::endl;
+                } else {
+                    std::cerr << "[AirRide] Not starting " << node.name
+                              << ": a required dependency failed" << std::endl;
+                }
+                t->settle(i, false);
+                return;
+            }
+            if (node.device) {
+                wait_for_device(device_node(node.name), [tx = t->shared_from_this(), i](bool ok) {
+                    tx->settle(i, ok);
+                });
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(services_mutex);
+                auto it = services.find(node.name);
+                if (it != services.end() && it->second.timeline.deps_ready == 0) {
+                    it->second.timeline.deps_ready = monotonic_us();
+                    it->second.timeline.waited_on = node.waited_on;
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(t->mutex);
+                if (node.serial) {
+                    if (t->serial_busy) {
+                        t->serial_waiting.push_back(i);
+                        return;
+                    }
+                    t->serial_busy = true;
+                }
+            }
+            acquire_start_slot([this, tx = t->shared_from_this(), i]() {
+                const StartNode& node = tx->nodes[i];
+                if (node.tty && tx->boot) {
+                    bool first;
+                    {
+                        std::lock_guard<std::mutex> lock(tx->mutex);
+                        first = !tx->console_cleared;
+                        tx->console_cleared = true;
+                    }
+                    if (first) clear_console();
+                }
+                if (!start_service_internal(node.name)) {
+                    release_start_slot();
+                    tx->settle(i, false);
+                    return;
+                }
+                // The slot goes back when the unit settles, or earlier if
+                // it is slow to, so a unit that never reports ready cannot
+                // hold up the rest of the boot
+                auto held = std::make_shared<std::atomic<bool>>(true);
+                auto give_back = [this, held]() {
+                    if (held->exchange(false)) release_start_slot();
+                };
+                loop.post([this, give_back]() { loop.add_timer(START_SLOT_HOLD_MS, give_back); });
+                when_settled(node.name, [tx, i, give_back](bool ok) {
+                    give_back();
+                    tx->settle(i, ok);
+                });
+            });
+        };
 
-enum class ServiceState { STOPPED, STARTING, RUNNING, STOPPING, FAILED };
-enum class ServiceType { SIMPLE, FORKING, ONESHOT };
+        std::vector<size_t> initial;
+        for (size_t i = 0; i < tx->nodes.size(); i++) {
+            if (tx->nodes[i].pending == 0) initial.push_back(i);
+        }
+        for (size_t i : initial) tx->dispatch(i);
+    }
 
-struct Service {
-    std::string name;
-    std::string description;
-    ServiceType type = ServiceType::SIMPLE;
-    std::string exec_start;
-    std::string exec_stop;
-    std::string tty_device;  // TTY device for this service
-    std::vector<std::string> requires;
-    std::vector<std::string> after;
-    bool restart_on_failure = false;
-    bool autostart = false;
-    bool parallel = false;
-    bool clear_screen = false;
-    bool foreground = false;
-    int restart_delay = 5;
-    pid_t pid = 0;
-    ServiceState state = ServiceState::STOPPED;
-    int failures = 0;
-};
+    // Called with slots_mutex held. Under pressure only one launch is let
+    // through at a time, so a system that never calms down still boots.
+    bool slot_available() {
+        if (slots_used >= slots_total) return false;
+        return !under_pressure || slots_used == 0;
+    }
 
-class AirRide {
-private:
-    std::map<std::string, Service> services;
-    std::atomic<bool> running{true};
-    int control_socket = -1;
-    std::mutex services_mutex;
+    // Run `launch` on the start pool once it may go; it must call
+    // release_start_slot() once the service has settled or had long enough
+    void acquire_start_slot(std::function<void()> launch) {
+        {
+            std::lock_guard<std::mutex> lock(slots_mutex);
+            if (!slot_available()) {
+                slot_waiting.push_back(std::move(launch));
+                return;
+            }
+            slots_used++;
+        }
+        start_pool.submit(std::move(launch));
+    }
 
-    void mount_filesystems() {
-        std::cout << "[AirRide] Mounting filesystems..." << std::endl;
-        
-        mkdir("/proc", 0755);
-        mkdir("/sys", 0755);
-        mkdir("/dev", 0755);
-        mkdir("/run", 0755);
-        mkdir("/tmp", 0755);
-        mkdir("/dev/pts", 0755);
-        mkdir("/dev/dri", 0755);
-        mkdir(LOG_DIR, 0755);
-        mkdir("/var/log", 0755);
-        mkdir("/usr/share/udhcpc", 0755);
-        
-        mount("proc", "/proc", "proc", MS_NOEXEC | MS_NOSUID | MS_NODEV, nullptr);
-        mount("sysfs", "/sys", "sysfs", MS_NOEXEC | MS_NOSUID | MS_NODEV, nullptr);
-        mount("devtmpfs", "/dev", "devtmpfs", MS_NOSUID, "mode=0755");
-        mount("devpts", "/dev/pts", "devpts", 0, "gid=5,mode=620");
-        mount("tmpfs", "/run", "tmpfs", MS_NOEXEC | MS_NOSUID | MS_NODEV, "mode=0755");
-        mount("tmpfs", "/tmp", "tmpfs", MS_NOEXEC | MS_NOSUID | MS_NODEV, "mode=1777");
-        
-        // Create essential device nodes
-        mknod("/dev/console", S_IFCHR | 0600, makedev(5, 1));
-        mknod("/dev/null", S_IFCHR | 0666, makedev(1, 3));
-        mknod("/dev/zero", S_IFCHR | 0666, makedev(1, 5));
-        mknod("/dev/random", S_IFCHR | 0666, makedev(1, 8));
-        mknod("/dev/urandom", S_IFCHR | 0666, makedev(1, 9));
-        mknod("/dev/tty", S_IFCHR | 0666, makedev(5, 0));
-        mknod("/dev/tty0", S_IFCHR | 0620, makedev(4, 0));
-        mknod("/dev/tty1", S_IFCHR | 0620, makedev(4, 1));
-        mknod("/dev/tty2", S_IFCHR | 0620, makedev(4, 2));
-        mknod("/dev/tty3", S_IFCHR | 0620, makedev(4, 3));
-        mknod("/dev/ttyS0", S_IFCHR | 0660, makedev(4, 64));
-        mknod("/dev/fb0", S_IFCHR | 0666, makedev(29, 0));
-        mknod("/dev/dri/card0", S_IFCHR | 0666, makedev(226, 0));
-        mknod("/dev/dri/renderD128", S_IFCHR | 0666, makedev(226, 128));
-        
-        // Set hostname early
-        set_hostname();
-        
-        std::cout << "[AirRide] Filesystems ready" << std::endl;
+    void release_start_slot() {
+        {
+            std::lock_guard<std::mutex> lock(slots_mutex);
+            slots_used--;
+        }
+        pump_start_slots();
     }
 
-    void set_hostname() {
-        std::ifstream hf("/etc/hostname");
-        std::string hostname = "galactica";
-        if (hf.is_open()) {
-            std::getline(hf, hostname);
-            hf.close();
+    void pump_start_slots() {
+        std::vector<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> lock(slots_mutex);
+            while (!slot_waiting.empty() && slot_available()) {
+                slots_used++;
+                ready.push_back(std::move(slot_waiting.front()));
+                slot_waiting.pop_front();
+            }
         }
-        if (!hostname.empty()) {
-            sethostname(hostname.c_str(), hostname.length());
+        for (auto& launch : ready) start_pool.submit(std::move(launch));
+    }
+
+    void setup_start_slots() {
+        unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+        slots_total = cpus;
+        if (!start_slots_option.empty()) {
+            int n;
+            if (parse_int(start_slots_option, n) && n > 0) slots_total = n;
+            else std::cerr << "[AirRide] Bad start slot count: " << start_slots_option << std::endl;
+        }
+        // Pool threads only launch; waiting for readiness holds no thread
+        start_pool.start(std::max(4u, slots_total));
+        
+        std::string trigger = "some " + std::to_string(PSI_STALL_US) + " " + std::to_string(PSI_WINDOW_US);
+        int watched = 0;
+        for (const char* resource : {"cpu", "io", "memory"}) {
+            std::string path = std::string("/proc/pressure/") + resource;
+            int fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+            if (fd == -1) continue;
+            if (write(fd, trigger.c_str(), trigger.size() + 1) == -1) {
+                close(fd);
+                continue;
+            }
+            std::string name = resource;
+            loop.watch(fd, EPOLLPRI, [this, fd, name](uint32_t events) {
+                if (events & EPOLLERR) {
+                    loop.unwatch(fd);
+                    close(fd);
+                    return;
+                }
+                pressure_event(name);
+            });
+            watched++;
         }
+        std::cout << "[AirRide] " << slots_total << " start slots"
+                  << (watched ? ", throttled by pressure stall information" : "") << std::endl;
     }
 
-    void clear_console() {
-        int fd = open("/dev/console", O_WRONLY);
-        if (fd >= 0) {
-            const char* clear = "\033[2J\033[H";
-            write(fd, clear, strlen(clear));
-            close(fd);
+    // A PSI trigger fires while a stall lasts; launches resume once a full
+    // window has passed without one. Event loop thread only.
+    void pressure_event(const std::string& resource) {
+        uint64_t seq = ++pressure_seq;
+        {
+            std::lock_guard<std::mutex> lock(slots_mutex);
+            if (!under_pressure) {
+                std::cout << "[AirRide] " << resource << " pressure, holding back service starts" << std::endl;
+            }
+            under_pressure = true;
         }
-        std::cout << "\033[2J\033[H" << std::flush;
+        loop.add_timer(PSI_WINDOW_US / 1000, [this, seq]() {
+            if (seq != pressure_seq) return;
+            {
+                std::lock_guard<std::mutex> lock(slots_mutex);
+                under_pressure = false;
+            }
+            std::cout << "[AirRide] Pressure eased, resuming service starts" << std::endl;
+            pump_start_slots();
+        });
     }
 
-    bool parse_service_file(const std::string& filepath) {
-        std::ifstream file(filepath);
-        if (!file.is_open()) return false;
+    bool stop_service(const std::string& name) {
+        std::unique_lock<std::mutex> lock(services_mutex);
+        auto it = services.find(name);
+        if (it == services.end()) return false;
 
-        Service svc;
-        std::string line, current_section;
+        Service& svc = it->second;
+        // A unit being cloned gets its pid in a moment
+        services_cv.wait(lock, [&svc] { return !svc.spawning; });
+        bool starting = svc.state == ServiceState::STARTING && svc.pid > 0;
+        if (svc.state != ServiceState::RUNNING && !starting) return true;
 
-        while (std::getline(file, line)) {
-            line.erase(0, line.find_first_not_of(" \t"));
-            line.erase(line.find_last_not_of(" \t\r\n") + 1);
-            
-            if (line.empty() || line[0] == '#') continue;
+        std::cout << "[AirRide] Stopping " << svc.name << std::endl;
+        svc.state = ServiceState::STOPPING;
+        services_changed();
+
+        pid_t pid = svc.pid;
+        if (pid > 0) {
+            auto exited = [&svc, pid] { return svc.pid != pid; };
+            // Private dup: the loop closes svc.pidfd as soon as it reaps
+            int fd = svc.pidfd != -1 ? fcntl(svc.pidfd, F_DUPFD_CLOEXEC, 0) : -1;
             
-            if (line[0] == '[' && line.back() == ']') {
-                current_section = line.substr(1, line.length()-2);
-                continue;
+            if (fd != -1) {
+                pidfd_send_signal(fd, SIGTERM);
+                lock.unlock();
+                bool gone = pidfd_wait_exit(fd, svc.stop_timeout * 1000);
+                if (!gone) {
+                    if (!kill_cgroup(svc.cgroup)) pidfd_send_signal(fd, SIGKILL);
+                    pidfd_wait_exit(fd, SHUTDOWN_KILL_WAIT * 1000);
+                }
+                close(fd);
+                lock.lock();
+                // The exit is already queued on the loop; this is brief
+                services_cv.wait_for(lock, std::chrono::seconds(1), exited);
+            } else {
+                kill(pid, SIGTERM);
+                if (!services_cv.wait_for(lock, std::chrono::seconds(svc.stop_timeout), exited)) {
+                    kill(pid, SIGKILL);
+                    services_cv.wait_for(lock, std::chrono::seconds(SHUTDOWN_KILL_WAIT), exited);
+                }
+            }
+            if (svc.pid == pid) {
+                pid_index.erase(pid);
+                svc.pid = 0;
+            }
+        }
+        // Whatever the main process left behind goes with it
+        kill_cgroup(svc.cgroup);
+
+        svc.state = ServiceState::STOPPED;
+        services_changed();
+        return true;
+    }
+
+    // Stop every running unit in reverse dependency order. A unit is sent
+    // SIGTERM as soon as everything ordered after it has exited, so
+    // independent branches go down together; each gets its own
+    // stop_timeout before SIGKILL. Runs on its own thread.
+    void stop_all_services() {
+        struct StopNode {
+            std::string name;
+            pid_t pid = 0;
+            std::vector<size_t> deps;   // stopped once this one is gone
+            size_t blockers = 0;        // dependents still running
+            int stage = 0;              // 0 waiting, 1 SIGTERM, 2 SIGKILL, 3 gone
+            std::chrono::steady_clock::time_point deadline;
+        };
+        int64_t started = monotonic_us();
+        std::vector<StopNode> nodes;
+        std::map<std::string, size_t> index;
+        
+        std::unique_lock<std::mutex> lock(services_mutex);
+        // Launches already past the shutting_down check finish first
+        services_cv.wait(lock, [this] { return spawns_in_flight == 0; });
+        for (const auto& [name, svc] : services) {
+            if (svc.pid <= 0) continue;
+            index[name] = nodes.size();
+            nodes.emplace_back();
+            nodes.back().name = name;
+            nodes.back().pid = svc.pid;
+        }
+        for (auto& node : nodes) {
+            const Service& svc = services[node.name];
+            std::set<std::string> deps(svc.requires.begin(), svc.requires.end());
+            deps.insert(svc.after.begin(), svc.after.end());
+            for (const auto& dep : deps) {
+                auto it = index.find(dep);
+                if (it == index.end()) continue;
+                node.deps.push_back(it->second);
+                nodes[it->second].blockers++;
+            }
+        }
+        
+        auto send = [this](Service& svc, int sig) {
+            if (sig == SIGKILL && kill_cgroup(svc.cgroup)) return;
+            if (svc.pidfd != -1) pidfd_send_signal(svc.pidfd, sig);
+            else kill(svc.pid, sig);
+        };
+        
+        size_t remaining = nodes.size();
+        while (remaining > 0) {
+            auto now = std::chrono::steady_clock::now();
+            // A dependency cycle leaves nothing ready or in flight; break it
+            bool stuck = true;
+            for (const auto& node : nodes) {
+                if (node.stage == 1 || node.stage == 2 || (node.stage == 0 && node.blockers == 0)) stuck = false;
+            }
+            for (auto& node : nodes) {
+                if (node.stage != 0 || (node.blockers > 0 && !stuck)) continue;
+                Service& svc = services[node.name];
+                if (svc.pid != node.pid) {
+                    node.stage = 1;
+                    continue;
+                }
+                std::cout << "[AirRide] Stopping " << node.name << std::endl;
+                svc.state = ServiceState::STOPPING;
+                services_changed();
+                send(svc, SIGTERM);
+                node.stage = 1;
+                node.deadline = now + std::chrono::seconds(svc.stop_timeout);
             }
             
-            size_t eq = line.find('=');
-            if (eq == std::string::npos) continue;
-            
-            std::string key = line.substr(0, eq);
-            std::string value = line.substr(eq + 1);
-            key.erase(key.find_last_not_of(" \t") + 1);
-            value.erase(0, value.find_first_not_of(" \t"));
-            
-            if (value.length() >= 2 && value[0] == '"' && value.back() == '"')
-                value = value.substr(1, value.length()-2);
-            
-            auto is_true = [](const std::string& v) {
-                return v == "true" || v == "yes" || v == "1";
-            };
+            auto next = now + std::chrono::seconds(SHUTDOWN_KILL_WAIT);
+            for (const auto& node : nodes) {
+                if (node.stage == 1 || node.stage == 2) next = std::min(next, node.deadline);
+            }
+            services_cv.wait_until(lock, next, [&] {
+                for (const auto& node : nodes) {
+                    if ((node.stage == 1 || node.stage == 2) && services[node.name].pid != node.pid) return true;
+                }
+                return false;
+            });
             
-            if (current_section == "Service") {
-                if (key == "name") svc.name = value;
-                else if (key == "description") svc.description = value;
-                else if (key == "exec_start") svc.exec_start = value;
-                else if (key == "exec_stop") svc.exec_stop = value;
-                else if (key == "tty") svc.tty_device = value;
-                else if (key == "autostart") svc.autostart = is_true(value);
-                else if (key == "parallel") svc.parallel = is_true(value);
-                else if (key == "clear_screen") svc.clear_screen = is_true(value);
-                else if (key == "foreground") svc.foreground = is_true(value);
-                else if (key == "type") {
-                    if (value == "simple") svc.type = ServiceType::SIMPLE;
-                    else if (value == "forking") svc.type = ServiceType::FORKING;
-                    else if (value == "oneshot") svc.type = ServiceType::ONESHOT;
+            now = std::chrono::steady_clock::now();
+            for (auto& node : nodes) {
+                if (node.stage != 1 && node.stage != 2) continue;
+                Service& svc = services[node.name];
+                bool gone = svc.pid != node.pid;
+                if (!gone && now < node.deadline) continue;
+                if (!gone && node.stage == 1) {
+                    std::cerr << "[AirRide] " << node.name << " ignored SIGTERM, killing" << std::endl;
+                    send(svc, SIGKILL);
+                    node.stage = 2;
+                    node.deadline = now + std::chrono::seconds(SHUTDOWN_KILL_WAIT);
+                    continue;
                 }
-                else if (key == "restart") svc.restart_on_failure = (value == "on-failure" || value == "always");
-                else if (key == "restart_delay") svc.restart_delay = std::stoi(value);
-            }
-            else if (current_section == "Dependencies") {
-                if (key == "requires" || key == "after") {
-                    std::vector<std::string>& target = (key == "requires") ? svc.requires : svc.after;
-                    std::istringstream ss(value);
-                    std::string dep;
-                    while (ss >> dep) target.push_back(dep);
+                if (!gone) {
+                    std::cerr << "[AirRide] " << node.name << " survived SIGKILL" << std::endl;
+                    pid_index.erase(node.pid);
+                    svc.pid = 0;
                 }
+                kill_cgroup(svc.cgroup);
+                svc.state = ServiceState::STOPPED;
+                services_changed();
+                node.stage = 3;
+                remaining--;
+                for (size_t d : node.deps) nodes[d].blockers--;
             }
         }
+        std::cout << "[AirRide] Stopped " << nodes.size() << " services in "
+                  << format_us(monotonic_us() - started) << std::endl;
+    }
 
-        if (!svc.name.empty()) {
+    // Refuse new starts, take down all services and leave the main loop;
+    // run() finishes the job once the loop has returned
+    bool begin_shutdown(ShutdownAction action) {
+        if (shutting_down.exchange(true)) return false;
+        shutdown_action = action;
+        static const char* verbs[] = {"Exiting", "Halting", "Powering off", "Rebooting"};
+        std::cout << "[AirRide] " << verbs[(int)action] << "..." << std::endl;
+        {
             std::lock_guard<std::mutex> lock(services_mutex);
-            services[svc.name] = svc;
-            return true;
+            for (const auto& [name, sock] : sockets) disarm_sockets(sock.service);
         }
-        return false;
+        std::thread([this]() {
+            stop_all_services();
+            running = false;
+            loop.post([]() {});
+        }).detach();
+        return true;
     }
 
-    void load_services() {
-        std::cout << "[AirRide] Loading services..." << std::endl;
+    // PID 1 only, after the loop has stopped: clear out stray processes,
+    // put the filesystems away and hand over to the kernel
+    void finish_shutdown() {
+        auto reap_until = [](int seconds) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+            while (std::chrono::steady_clock::now() < deadline) {
+                pid_t pid;
+                while ((pid = waitpid(-1, nullptr, WNOHANG)) > 0) {}
+                if (pid == -1 && errno == ECHILD) return;
+                usleep(50000);
+            }
+        };
+        std::cout << "[AirRide] Sending SIGTERM to remaining processes" << std::endl;
+        kill(-1, SIGTERM);
+        reap_until(SHUTDOWN_KILL_WAIT);
+        kill(-1, SIGKILL);
+        reap_until(SHUTDOWN_KILL_WAIT);
         
-        // Emergency shell - always available
-        Service shell;
-        shell.name = "shell";
-        shell.description = "Emergency Shell";
-        shell.type = ServiceType::SIMPLE;
-        shell.exec_start = "/bin/sh";
-        shell.foreground = true;
-        services["shell"] = shell;
+        sync();
+        unmount_filesystems();
+        sync();
+        console.drain(CONSOLE_DRAIN_MS);
         
-        // Scan services directory
-        DIR* dir = opendir(SERVICES_DIR);
-        if (dir) {
-            struct dirent* entry;
-            while ((entry = readdir(dir)) != nullptr) {
-                std::string fname = entry->d_name;
-                if (fname.length() > 8 && fname.substr(fname.length()-8) == ".service") {
-                    std::string path = std::string(SERVICES_DIR) + "/" + fname;
-                    parse_service_file(path);
-                }
-            }
-            closedir(dir);
+        switch (shutdown_action) {
+            case ShutdownAction::POWEROFF: reboot(RB_POWER_OFF); break;
+            case ShutdownAction::REBOOT: reboot(RB_AUTOBOOT); break;
+            default: reboot(RB_HALT_SYSTEM); break;
         }
-        
-        std::cout << "[AirRide] " << services.size() << " services loaded" << std::endl;
+        // Only reached if the kernel refused
+        std::cerr << "[AirRide] reboot(): " << strerror(errno) << std::endl;
+        while (true) pause();
     }
 
-    void wait_for_service(const std::string& name, int timeout_sec = 30) {
-        for (int i = 0; i < timeout_sec * 10; i++) {
-            {
-                std::lock_guard<std::mutex> lock(services_mutex);
-                auto it = services.find(name);
-                if (it != services.end()) {
-                    auto state = it->second.state;
-                    auto type = it->second.type;
-                    
-                    if (state == ServiceState::RUNNING) return;
-                    if (state == ServiceState::FAILED) return;
-                    if (type == ServiceType::ONESHOT && state == ServiceState::STOPPED) return;
+    // Innermost first; what cannot be unmounted is detached, and the
+    // root filesystem is left read-only
+    static void unmount_filesystems() {
+        std::vector<std::string> points;
+        std::ifstream mounts("/proc/self/mounts");
+        std::string line;
+        while (std::getline(mounts, line)) {
+            std::istringstream ss(line);
+            std::string device, point;
+            ss >> device >> point;
+            // Spaces and such are octal-escaped: "\040"
+            std::string decoded;
+            for (size_t i = 0; i < point.size(); i++) {
+                if (point[i] == '\\' && i + 3 < point.size()) {
+                    decoded += (char)std::stoi(point.substr(i + 1, 3), nullptr, 8);
+                    i += 3;
+                } else {
+                    decoded += point[i];
                 }
             }
-            usleep(100000);
+            if (decoded != "/") points.push_back(decoded);
+        }
+        for (auto it = points.rbegin(); it != points.rend(); ++it) {
+            if (umount2(it->c_str(), 0) == -1) umount2(it->c_str(), MNT_DETACH);
+        }
+        if (mount(nullptr, "/", nullptr, MS_REMOUNT | MS_RDONLY, nullptr) == -1) {
+            std::cerr << "[AirRide] Cannot remount / read-only: " << strerror(errno) << std::endl;
         }
     }
 
-    bool start_service_internal(const std::string& name) {
-        Service* svc = nullptr;
+    static const char* job_type_name(JobType type) {
+        switch (type) {
+            case JobType::START: return "start";
+            case JobType::STOP: return "stop";
+            case JobType::RESTART: return "restart";
+        }
+        return "unknown";
+    }
+
+    static const char* job_state_name(const Job& job) {
+        switch (job.state) {
+            case JobState::WAITING: return "waiting";
+            case JobState::RUNNING: return "running";
+            case JobState::DONE: return job.ok ? "done" : "failed";
+            case JobState::CANCELED: return "canceled";
+        }
+        return "unknown";
+    }
+
+    // Queue `type` on `unit`, merging with jobs already queued for it:
+    // an identical job is reused, restart absorbs start, and a start/stop
+    // conflict replaces the job that has not run yet.
+    std::shared_ptr<Job> enqueue_job(JobType type, const std::string& unit) {
+        return enqueue_jobs(type, {unit})[0];
+    }
+
+    // One job per unit. Start jobs that can run at once are run together
+    // as a single start transaction, so a batch of instances comes up in
+    // one pass over the dependency graph instead of one worker each.
+    std::vector<std::shared_ptr<Job>> enqueue_jobs(JobType type, const std::vector<std::string>& units) {
+        std::vector<std::shared_ptr<Job>> jobs, canceled, ready;
         {
-            std::lock_guard<std::mutex> lock(services_mutex);
-            auto it = services.find(name);
-            if (it == services.end()) {
-                std::cerr << "[AirRide] Service not found: " << name << std::endl;
-                return false;
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            for (const auto& unit : units) {
+                auto& [running, waiting] = unit_jobs[unit];
+                
+                if (waiting) {
+                    if (waiting->type == type || (waiting->type == JobType::RESTART && type == JobType::START)) {
+                        jobs.push_back(waiting);
+                        continue;
+                    }
+                    if (waiting->type == JobType::START && type == JobType::RESTART) {
+                        waiting->type = JobType::RESTART;
+                        jobs.push_back(waiting);
+                        continue;
+                    }
+                    waiting->state = JobState::CANCELED;
+                    waiting->finished = monotonic_us();
+                    canceled.push_back(waiting);
+                    waiting.reset();
+                } else if (running && (running->type == type ||
+                                       (running->type == JobType::RESTART && type == JobType::START))) {
+                    jobs.push_back(running);
+                    continue;
+                }
+                
+                auto job = std::make_shared<Job>();
+                job->id = next_job_id++;
+                job->type = type;
+                job->unit = unit;
+                job->queued = monotonic_us();
+                if (running) {
+                    waiting = job;
+                } else {
+                    running = job;
+                    ready.push_back(job);
+                }
+                jobs.push_back(job);
             }
-            svc = &it->second;
-            
-            if (svc->state == ServiceState::RUNNING) return true;
-            if (svc->state == ServiceState::STARTING) return true;
-            
-            svc->state = ServiceState::STARTING;
+            if (type == JobType::START && ready.size() > 1) run_start_batch(ready);
+            else for (const auto& job : ready) run_job(job);
+            for (const auto& c : canceled) remember_job(c);
         }
+        for (const auto& c : canceled) {
+            for (const auto& cb : c->on_done) cb(*c);
+        }
+        return jobs;
+    }
 
-        // Start dependencies first
-        for (const auto& dep : svc->requires) {
-            if (!start_service(dep)) {
-                std::lock_guard<std::mutex> lock(services_mutex);
-                svc->state = ServiceState::FAILED;
-                return false;
+    // Called with jobs_mutex held
+    void remember_job(const std::shared_ptr<Job>& job) {
+        job_history.push_back(job);
+        if (job_history.size() > JOB_HISTORY) job_history.pop_front();
+    }
+
+    // Called with jobs_mutex held
+    void run_job(std::shared_ptr<Job> job) {
+        job->state = JobState::RUNNING;
+        job->started = monotonic_us();
+        job_pool.submit([this, job]() {
+            bool ok = true;
+            if (job->type != JobType::START) ok = stop_service(job->unit);
+            if (job->type == JobType::STOP) {
+                finish_job(job, ok);
+                return;
             }
+            // A start can wait for a device or a slow notify unit; the
+            // transaction finishes the job so no worker waits with it
+            start_services_async({job->unit}, false, [this, job, ok](std::vector<bool> started) {
+                finish_job(job, ok && started[0]);
+            });
+        });
+    }
+
+    // Called with jobs_mutex held
+    void run_start_batch(const std::vector<std::shared_ptr<Job>>& batch) {
+        std::vector<std::string> units;
+        for (const auto& job : batch) {
+            job->state = JobState::RUNNING;
+            job->started = monotonic_us();
+            units.push_back(job->unit);
         }
+        job_pool.submit([this, batch, units]() {
+            start_services_async(units, false, [this, batch](std::vector<bool> ok) {
+                for (size_t i = 0; i < batch.size(); i++) finish_job(batch[i], ok[i]);
+            });
+        });
+    }
 
-        // Wait for 'after' dependencies
-        for (const auto& dep : svc->after) {
-            wait_for_service(dep, 10);
+    void finish_job(std::shared_ptr<Job> job, bool ok) {
+        std::vector<std::function<void(const Job&)>> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            job->ok = ok;
+            job->state = JobState::DONE;
+            job->finished = monotonic_us();
+            callbacks.swap(job->on_done);
+            remember_job(job);
+            
+            auto it = unit_jobs.find(job->unit);
+            auto& [running, waiting] = it->second;
+            running = std::move(waiting);
+            waiting.reset();
+            if (running) {
+                run_job(running);
+            } else {
+                unit_jobs.erase(it);
+            }
         }
+        for (const auto& cb : callbacks) cb(*job);
+    }
 
-        std::cout << "[AirRide] Starting " << svc->name;
-        if (!svc->tty_device.empty()) {
-            std::cout << " on " << svc->tty_device;
+    // Call `done(all_ok)` once every job has finished; may run immediately
+    void when_jobs_done(const std::vector<std::shared_ptr<Job>>& batch, std::function<void(bool)> done) {
+        struct Pending {
+            std::mutex mutex;
+            size_t left;
+            bool ok = true;
+        };
+        auto pending = std::make_shared<Pending>();
+        pending->left = batch.size() + 1;
+        auto settle = [pending, done](bool ok) {
+            std::unique_lock<std::mutex> lock(pending->mutex);
+            pending->ok = pending->ok && ok;
+            if (--pending->left > 0) return;
+            lock.unlock();
+            done(pending->ok);
+        };
+        
+        for (const auto& job : batch) {
+            std::unique_lock<std::mutex> lock(jobs_mutex);
+            if (job->state == JobState::DONE || job->state == JobState::CANCELED) {
+                bool ok = job->state == JobState::DONE && job->ok;
+                lock.unlock();
+                settle(ok);
+            } else {
+                job->on_done.push_back([settle](const Job& j) {
+                    settle(j.state == JobState::DONE && j.ok);
+                });
+            }
         }
-        std::cout << std::endl;
+        settle(true);
+    }
 
-        pid_t pid = fork();
-        if (pid == 0) {
-            // Child process
-            setsid();
-            
-            // Determine which TTY to use
-            std::string tty_path;
-            if (!svc->tty_device.empty()) {
-                tty_path = svc->tty_device;
-            } else if (svc->foreground) {
-                tty_path = "/dev/console";
-            }
-            
-            if (!tty_path.empty()) {
-                // Open TTY for this service
-                int fd = open(tty_path.c_str(), O_RDWR | O_NOCTTY);
-                if (fd >= 0) {
-                    dup2(fd, 0);
-                    dup2(fd, 1);
-                    dup2(fd, 2);
-                    if (fd > 2) close(fd);
-                    ioctl(0, TIOCSCTTY, 1);
-                }
+    std::string list_jobs(bool json) {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        std::vector<std::shared_ptr<Job>> all(job_history.begin(), job_history.end());
+        for (const auto& [unit, pair] : unit_jobs) {
+            if (pair.first) all.push_back(pair.first);
+            if (pair.second) all.push_back(pair.second);
+        }
+        std::sort(all.begin(), all.end(), [](const auto& a, const auto& b) { return a->id < b->id; });
+        
+        int64_t now = monotonic_us();
+        std::stringstream ss;
+        if (json) ss << "[";
+        else ss << "Jobs:\n";
+        for (size_t i = 0; i < all.size(); i++) {
+            const Job& job = *all[i];
+            int64_t end = job.finished ? job.finished : now;
+            int64_t took = job.started ? end - job.started : 0;
+            if (json) {
+                ss << (i ? "," : "") << "{\"id\":" << job.id
+                   << ",\"type\":\"" << job_type_name(job.type) << "\""
+                   << ",\"unit\":" << json_string(job.unit)
+                   << ",\"state\":\"" << job_state_name(job) << "\""
+                   << ",\"usec\":" << took << "}";
             } else {
-                // Background service - redirect to log file
-                std::string logfile = std::string(LOG_DIR) + "/" + svc->name + ".log";
-                int logfd = open(logfile.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
-                int nullfd = open("/dev/null", O_RDWR);
-                
-                if (nullfd >= 0) dup2(nullfd, 0);
-                if (logfd >= 0) {
-                    dup2(logfd, 1);
-                    dup2(logfd, 2);
-                    close(logfd);
-                } else if (nullfd >= 0) {
-                    dup2(nullfd, 1);
-                    dup2(nullfd, 2);
-                }
-                if (nullfd >= 0 && nullfd > 2) close(nullfd);
-            }
-            
-            // Parse and execute command
-            std::vector<char*> args;
-            std::vector<std::string> tokens;
-            std::istringstream iss(svc->exec_start);
-            std::string token;
-            while (iss >> token) tokens.push_back(token);
-            for (auto& t : tokens) args.push_back(&t[0]);
-            args.push_back(nullptr);
-            
-            execvp(args[0], args.data());
-            _exit(127);
-        } else if (pid > 0) {
-            std::lock_guard<std::mutex> lock(services_mutex);
-            svc->pid = pid;
-            svc->state = ServiceState::RUNNING;
-            
-            // For oneshot services, wait for completion
-            if (svc->type == ServiceType::ONESHOT) {
-                services_mutex.unlock();
-                
-                int status;
-                waitpid(pid, &status, 0);
-                
-                services_mutex.lock();
-                svc->pid = 0;
-                if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-                    svc->state = ServiceState::STOPPED;
-                    std::cout << "[AirRide] " << svc->name << " completed" << std::endl;
-                } else {
-                    svc->state = ServiceState::FAILED;
-                    std::cerr << "[AirRide] " << svc->name << " failed" << std::endl;
-                    return false;
-                }
+                ss << "  " << std::setw(5) << job.id << " " << std::left << std::setw(8)
+                   << job_type_name(job.type) << std::setw(9) << job_state_name(job)
+                   << std::right << job.unit;
+                if (job.started) ss << " (" << format_us(took) << ")";
+                ss << "\n";
             }
-            return true;
         }
-        
-        std::lock_guard<std::mutex> lock(services_mutex);
-        svc->state = ServiceState::FAILED;
-        return false;
+        if (json) ss << "]\n";
+        return ss.str();
     }
 
-    bool start_service(const std::string& name) {
-        return start_service_internal(name);
+    std::vector<std::shared_ptr<Job>> find_jobs(const std::vector<std::string>& ids) {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        std::vector<std::shared_ptr<Job>> found;
+        for (const auto& arg : ids) {
+            uint32_t id = strtoul(arg.c_str(), nullptr, 10);
+            for (const auto& job : job_history) {
+                if (job->id == id) found.push_back(job);
+            }
+            for (const auto& [unit, pair] : unit_jobs) {
+                if (pair.first && pair.first->id == id) found.push_back(pair.first);
+                if (pair.second && pair.second->id == id) found.push_back(pair.second);
+            }
+        }
+        return found;
     }
 
-    bool stop_service(const std::string& name) {
-        std::lock_guard<std::mutex> lock(services_mutex);
-        auto it = services.find(name);
-        if (it == services.end()) return false;
+    static const char* state_name(ServiceState state) {
+        switch (state) {
+            case ServiceState::STOPPED: return "stopped";
+            case ServiceState::STARTING: return "starting";
+            case ServiceState::RUNNING: return "running";
+            case ServiceState::STOPPING: return "stopping";
+            case ServiceState::FAILED: return "failed";
+        }
+        return "unknown";
+    }
 
-        Service& svc = it->second;
-        if (svc.state != ServiceState::RUNNING) return true;
+    static const char* type_name(ServiceType type) {
+        switch (type) {
+            case ServiceType::SIMPLE: return "simple";
+            case ServiceType::FORKING: return "forking";
+            case ServiceType::ONESHOT: return "oneshot";
+            case ServiceType::NOTIFY: return "notify";
+        }
+        return "unknown";
+    }
 
-        std::cout << "[AirRide] Stopping " << svc.name << std::endl;
-        svc.state = ServiceState::STOPPING;
+    static const char* sched_policy_name(int policy) {
+        switch (policy) {
+            case SCHED_OTHER: return "other";
+            case SCHED_BATCH: return "batch";
+            case SCHED_IDLE: return "idle";
+            case SCHED_FIFO: return "fifo";
+            case SCHED_RR: return "rr";
+        }
+        return "unknown";
+    }
 
-        if (svc.pid > 0) {
-            kill(svc.pid, SIGTERM);
-            
-            services_mutex.unlock();
-            for (int i = 0; i < 50; i++) {
-                usleep(100000);
-                int status;
-                if (waitpid(svc.pid, &status, WNOHANG) > 0) {
-                    break;
-                }
-            }
-            services_mutex.lock();
-            
-            if (svc.pid > 0) {
-                kill(svc.pid, SIGKILL);
-                waitpid(svc.pid, nullptr, 0);
+    static std::string json_string(const std::string& s) {
+        std::string out = "\"";
+        for (unsigned char c : s) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (c < 0x20) {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                out += esc;
+            } else {
+                out += c;
             }
-            svc.pid = 0;
         }
-
-        svc.state = ServiceState::STOPPED;
-        return true;
+        return out + "\"";
     }
 
-    std::string get_service_status(const std::string& name) {
-        std::lock_guard<std::mutex> lock(services_mutex);
-        auto it = services.find(name);
-        if (it == services.end()) return "Service not found\n";
+    std::string get_service_status(const ServiceTable& table, const std::string& name) {
+        const ServiceView* view = table.find(name);
+        if (!view) return "Service not found\n";
 
-        Service& svc = it->second;
+        const ServiceView& svc = *view;
         std::stringstream ss;
         ss << "Service: " << svc.name << "\n";
         ss << "Description: " << svc.description << "\n";
-        ss << "State: ";
-        switch (svc.state) {
-            case ServiceState::STOPPED: ss << "stopped"; break;
-            case ServiceState::STARTING: ss << "starting"; break;
-            case ServiceState::RUNNING: ss << "running"; break;
-            case ServiceState::STOPPING: ss << "stopping"; break;
-            case ServiceState::FAILED: ss << "failed"; break;
-        }
-        ss << "\n";
+        ss << "State: " << state_name(svc.state) << "\n";
         if (svc.pid > 0) ss << "PID: " << svc.pid << "\n";
         if (!svc.tty_device.empty()) ss << "TTY: " << svc.tty_device << "\n";
+        if (!svc.status_text.empty()) ss << "Status: " << svc.status_text << "\n";
+        if (svc.changed) ss << "Changed on disk: restart to apply\n";
+        
+        const ExecAttributes& a = svc.attrs;
+        if (!a.cpu_affinity.empty()) ss << "CPU affinity: " << format_cpu_list(a.cpu_affinity) << "\n";
+        if (a.sched_policy != -1) {
+            ss << "Scheduling: " << sched_policy_name(a.sched_policy);
+            if (a.sched_priority) ss << " " << a.sched_priority;
+            ss << "\n";
+        }
+        if (a.nice != ATTR_UNSET) ss << "Nice: " << a.nice << "\n";
+        if (a.io_class != 0) {
+            static const char* classes[] = {"none", "realtime", "best-effort", "idle"};
+            ss << "IO class: " << classes[a.io_class];
+            if (a.io_class != 3) ss << " " << a.io_priority;
+            ss << "\n";
+        }
+        if (a.oom_score_adjust != ATTR_UNSET) ss << "OOM score adjust: " << a.oom_score_adjust << "\n";
+        if (a.timer_slack > 0) ss << "Timer slack: " << a.timer_slack << "ns\n";
+        
+        CgroupStats st = cgroup_stats(svc.cgroup);
+        if (st.valid) {
+            ss << "CPU: " << format_us(st.cpu_usec) << " (user " << format_us(st.user_usec)
+               << ", system " << format_us(st.system_usec) << ")\n";
+            if (st.has_memory) {
+                ss << "Memory: " << format_bytes(st.memory);
+                if (st.memory_peak) ss << " (peak " << format_bytes(st.memory_peak) << ")";
+                ss << "\n";
+            }
+            if (st.has_io) {
+                ss << "IO: read " << format_bytes(st.io_read) << ", written " << format_bytes(st.io_written) << "\n";
+            }
+            if (st.tasks) ss << "Tasks: " << st.tasks << "\n";
+        }
         return ss.str();
     }
 
-    std::string list_services() {
-        std::lock_guard<std::mutex> lock(services_mutex);
+    std::string service_json(const ServiceView& svc) {
         std::stringstream ss;
-        ss << "Services:\n";
-        for (const auto& [name, svc] : services) {
-            ss << "  " << name << " - ";
-            switch (svc.state) {
-                case ServiceState::STOPPED: ss << "stopped"; break;
-                case ServiceState::STARTING: ss << "starting"; break;
-                case ServiceState::RUNNING: ss << "running"; break;
-                case ServiceState::STOPPING: ss << "stopping"; break;
-                case ServiceState::FAILED: ss << "failed"; break;
+        ss << "{\"name\":" << json_string(svc.name)
+           << ",\"description\":" << json_string(svc.description)
+           << ",\"type\":\"" << type_name(svc.type) << "\""
+           << ",\"state\":\"" << state_name(svc.state) << "\""
+           << ",\"pid\":" << svc.pid
+           << ",\"autostart\":" << (svc.autostart ? "true" : "false")
+           << ",\"tty\":" << json_string(svc.tty_device)
+           << ",\"status\":" << json_string(svc.status_text)
+           << ",\"failures\":" << svc.failures;
+        CgroupStats st = cgroup_stats(svc.cgroup);
+        if (st.valid) {
+            ss << ",\"cgroup\":{\"cpu_usec\":" << st.cpu_usec
+               << ",\"memory\":" << st.memory << ",\"memory_peak\":" << st.memory_peak
+               << ",\"io_read\":" << st.io_read << ",\"io_written\":" << st.io_written
+               << ",\"tasks\":" << st.tasks << "}";
+        }
+        ss << "}";
+        return ss.str();
+    }
+
+    std::string services_json(const ServiceTable& table, const std::vector<std::string>& names) {
+        std::string json = "[";
+        bool first = true;
+        auto add = [&](const ServiceView& svc) {
+            json += (first ? "" : ",") + service_json(svc);
+            first = false;
+        };
+        if (names.empty()) {
+            for (const auto& view : table.services) add(*view);
+        } else {
+            for (const auto& name : names) {
+                if (const ServiceView* view = table.find(name)) add(*view);
             }
+        }
+        return json + "]\n";
+    }
+
+    std::string list_services(const ServiceTable& table) {
+        std::stringstream ss;
+        ss << "Services:\n";
+        for (const auto& view : table.services) {
+            const ServiceView& svc = *view;
+            ss << "  " << svc.name << " - " << state_name(svc.state);
             if (svc.autostart) ss << " [auto]";
+            if (svc.socket) ss << " [socket]";
+            if (svc.changed) ss << " [changed]";
             if (!svc.tty_device.empty()) ss << " [" << svc.tty_device << "]";
             ss << "\n";
         }
         return ss.str();
     }
 
+    static std::string format_us(int64_t us) {
+        std::stringstream ss;
+        if (us >= 1000000) ss << us / 1000000 << "." << std::setw(3) << std::setfill('0') << (us / 1000) % 1000 << "s";
+        else ss << us / 1000 << "ms";
+        return ss.str();
+    }
+
+    // `analyze [blame|critical-chain|trace]`; no argument prints the summary,
+    // phases, blame list and critical chain together
+    std::string analyze_boot(const std::string& what) {
+        std::lock_guard<std::mutex> lock(services_mutex);
+        if (what == "trace") return boot_trace_json();
+        
+        std::stringstream ss;
+        bool all = what.empty();
+        if (!all && what != "phases" && what != "blame" && what != "critical-chain") {
+            return "Unknown analyze view: " + what + "\n";
+        }
+
+        if (all || what == "phases") {
+            int64_t finished = init_started;
+            for (const auto& [name, svc] : services) {
+                finished = std::max(finished, svc.timeline.ready);
+            }
+            ss << "Startup finished in " << format_us(init_started) << " (kernel) + "
+               << format_us(finished - init_started) << " (userspace) = "
+               << format_us(finished) << "\n\nPhases:\n";
+            for (const auto& phase : boot_phases) {
+                ss << "  " << std::setw(10) << std::setfill(' ') << format_us(phase.end - phase.start)
+                   << " " << phase.name << "\n";
+            }
+            ss << "\n";
+        }
+
+        if (all || what == "blame") {
+            // Activation time: fork until ready
+            std::vector<std::pair<int64_t, std::string>> blame;
+            for (const auto& [name, svc] : services) {
+                const auto& t = svc.timeline;
+                if (t.forked && t.ready) blame.push_back({t.ready - t.forked, name});
+            }
+            std::sort(blame.rbegin(), blame.rend());
+            if (all) ss << "Blame:\n";
+            for (const auto& [us, name] : blame) {
+                ss << "  " << std::setw(10) << std::setfill(' ') << format_us(us) << " " << name << "\n";
+            }
+            if (all) ss << "\n";
+        }
+
+        if (all || what == "critical-chain") {
+            // Walk back from the autostart unit that became ready last
+            const Service* last = nullptr;
+            for (const auto& [name, svc] : services) {
+                if (!svc.autostart || !svc.timeline.ready) continue;
+                if (!last || svc.timeline.ready > last->timeline.ready) last = &svc;
+            }
+            if (all) ss << "Critical chain:\n";
+            std::string indent = "  ";
+            for (int depth = 0; last && depth < 64; depth++) {
+                const auto& t = last->timeline;
+                ss << indent << last->name << " @" << format_us(t.ready - init_started);
+                if (t.forked) ss << " +" << format_us(t.ready - t.forked);
+                ss << "\n";
+                auto it = services.find(t.waited_on);
+                last = it != services.end() ? &it->second : nullptr;
+                indent += "  ";
+                if (!last && !device_node(t.waited_on).empty()) ss << indent << t.waited_on << "\n";
+            }
+        }
+        return ss.str();
+    }
+
+    // Chrome trace-event JSON (chrome://tracing, Perfetto). Each unit gets
+    // its own track with a "waiting" slice for dependency time followed by
+    // an "activating" slice from fork to ready.
+    std::string boot_trace_json() {
+        std::vector<std::string> events;
+        auto slice = [&](const std::string& name, const std::string& cat, int tid,
+                         int64_t start, int64_t end) {
+            if (!start || end < start) return;
+            std::stringstream ev;
+            ev << "{\"name\":" << json_string(name) << ",\"cat\":" << json_string(cat) << ",\"ph\":\"X\",\"pid\":1,\"tid\":"
+               << tid << ",\"ts\":" << start << ",\"dur\":" << end - start << "}";
+            events.push_back(ev.str());
+        };
+
+        for (const auto& phase : boot_phases) {
+            slice(phase.name, "phase", 0, phase.start, phase.end);
+        }
+        int tid = 1;
+        for (const auto& [name, svc] : services) {
+            const auto& t = svc.timeline;
+            if (!t.queued && !t.forked) continue;
+            slice(name + " waiting", "wait", tid, t.queued, t.deps_ready ? t.deps_ready : t.forked);
+            slice(name, "activating", tid, t.forked, t.ready ? t.ready : t.exited);
+            if (t.exec) {
+                events.push_back("{\"name\":\"exec\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":" +
+                                 std::to_string(tid) + ",\"ts\":" + std::to_string(t.exec) + "}");
+            }
+            events.push_back("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" +
+                             std::to_string(tid) + ",\"args\":{\"name\":" + json_string(name) + "}}");
+            tid++;
+        }
+
+        std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        for (size_t i = 0; i < events.size(); i++) {
+            json += (i ? ",\n" : "\n") + events[i];
+        }
+        return json + "\n]}\n";
+    }
+
     void setup_control_socket() {
-        control_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        control_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
         if (control_socket == -1) return;
 
-        unlink(AIRRIDE_SOCKET);
-
         struct sockaddr_un addr;
         memset(&addr, 0, sizeof(addr));
         addr.sun_family = AF_UNIX;
-        strncpy(addr.sun_path, AIRRIDE_SOCKET, sizeof(addr.sun_path) - 1);
+        if (paths.socket.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "[AirRide] Control socket path too long: " << paths.socket << std::endl;
+            close(control_socket);
+            control_socket = -1;
+            return;
+        }
+        strncpy(addr.sun_path, paths.socket.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(paths.socket.c_str());
 
         if (bind(control_socket, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
             listen(control_socket, 5) == -1) {
@@ -457,122 +6130,536 @@ private:
             return;
         }
 
-        fcntl(control_socket, F_SETFL, fcntl(control_socket, F_GETFL, 0) | O_NONBLOCK);
+        loop.watch(control_socket, EPOLLIN, [this](uint32_t) { accept_control_clients(); });
     }
 
-    void handle_control_commands() {
-        if (control_socket == -1) return;
+    void accept_control_clients() {
+        int client;
+        while ((client = accept4(control_socket, nullptr, nullptr,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+            auto conn = std::make_shared<ControlConnection>(loop, client);
+            loop.watch(client, EPOLLIN | EPOLLRDHUP, [this, conn](uint32_t events) {
+                handle_control_event(conn, events);
+            });
+        }
+    }
+
+    void handle_control_event(std::shared_ptr<ControlConnection> conn, uint32_t events) {
+        if (events & EPOLLOUT) conn->on_writable();
+        
+        bool eof = events & (EPOLLHUP | EPOLLERR);
+        if (events & (EPOLLIN | EPOLLRDHUP)) {
+            char buffer[8192];
+            ssize_t n;
+            while ((n = read(conn->fd, buffer, sizeof(buffer))) > 0) {
+                conn->inbuf.append(buffer, n);
+            }
+            if (n == 0 || (n == -1 && errno != EAGAIN)) eof = true;
+        }
+        
+        if (!process_control_input(conn) || eof) conn->close_connection();
+    }
 
-        int client = accept(control_socket, nullptr, nullptr);
-        if (client == -1) return;
+    // Split buffered input into requests; false on a protocol error
+    bool process_control_input(const std::shared_ptr<ControlConnection>& conn) {
+        std::string& in = conn->inbuf;
+        if (conn->legacy || conn->finished) {
+            in.clear();
+            return true;
+        }
+        if (!in.empty() && (in[0] != 'A' || (in.size() > 1 && in[1] != 'R'))) {
+            // Old airridectl: the whole first read is the command
+            conn->legacy = true;
+            std::string line = in.substr(0, in.find('\n'));
+            in.clear();
+            execute_command(conn, 0, line, false);
+            return true;
+        }
 
-        char buffer[1024];
-        ssize_t n = read(client, buffer, sizeof(buffer) - 1);
-        if (n > 0) {
-            buffer[n] = '\0';
-            std::istringstream iss(buffer);
-            std::string cmd, svc_name;
-            iss >> cmd >> svc_name;
+        while (in.size() >= sizeof(ControlFrame)) {
+            ControlFrame hdr;
+            memcpy(&hdr, in.data(), sizeof(hdr));
+            if (hdr.magic[0] != 'A' || hdr.magic[1] != 'R' || hdr.length > CONTROL_MAX_REQUEST) {
+                return false;
+            }
+            if (in.size() < sizeof(hdr) + hdr.length) break;
+            
+            std::string payload = in.substr(sizeof(hdr), hdr.length);
+            in.erase(0, sizeof(hdr) + hdr.length);
+            if (hdr.version != CONTROL_VERSION) {
+                conn->reply(hdr.id, "Unsupported protocol version " + std::to_string(hdr.version) + "\n", true);
+            } else if (hdr.type == FRAME_REQUEST) {
+                execute_command(conn, hdr.id, payload, hdr.flags & CONTROL_JSON);
+            }
+        }
+        return true;
+    }
 
-            std::string response;
-            if (cmd == "start") response = start_service(svc_name) ? "OK\n" : "FAILED\n";
-            else if (cmd == "stop") response = stop_service(svc_name) ? "OK\n" : "FAILED\n";
-            else if (cmd == "restart") {
-                stop_service(svc_name);
-                usleep(500000);
-                response = start_service(svc_name) ? "OK\n" : "FAILED\n";
+    void execute_command(std::shared_ptr<ControlConnection> conn, uint32_t id,
+                         const std::string& line, bool json) {
+        std::istringstream iss(line);
+        std::vector<std::string> args;
+        std::string arg;
+        while (iss >> arg) args.push_back(arg);
+        if (args.empty()) {
+            conn->reply(id, "Unknown command\n", true);
+            return;
+        }
+        
+        const std::string& cmd = args[0];
+        std::vector<std::string> names(args.begin() + 1, args.end());
+        
+        if (cmd == "ping") conn->reply(id, "pong\n");
+        else if (cmd == "list") {
+            auto table = current_table();
+            conn->reply(id, json ? services_json(*table, {}) : list_services(*table));
+        }
+        else if (cmd == "status") {
+            auto table = current_table();
+            bool missing = names.empty();
+            std::string text;
+            for (const auto& name : names) {
+                if (!table->find(name)) missing = true;
+            }
+            if (json) {
+                text = services_json(*table, names);
+            } else {
+                for (const auto& name : names) {
+                    text += (text.empty() ? "" : "\n") + get_service_status(*table, name);
+                }
+            }
+            conn->reply(id, text.empty() ? "Service not found\n" : text, missing);
+        }
+        else if (cmd == "analyze") {
+            std::string text = analyze_boot(names.empty() ? "" : names[0]);
+            conn->reply(id, text, text.rfind("Unknown", 0) == 0);
+        }
+        else if (cmd == "logs" && !names.empty()) {
+            serve_logs(conn, id, names[0], names.size() > 1 && names[1] == "-f");
+        }
+        else if (cmd == "journal") serve_journal(conn, id, args);
+        else if (cmd == "start" || cmd == "stop" || cmd == "restart") {
+            bool block = true;
+            if (!names.empty() && names[0] == "--no-block") {
+                block = false;
+                names.erase(names.begin());
+            }
+            if (names.empty()) {
+                conn->reply(id, "Service name required\n", true);
+                return;
+            }
+            
+            JobType type = cmd == "start" ? JobType::START : cmd == "stop" ? JobType::STOP : JobType::RESTART;
+            // Expand worker@{1..32} here too, for shells that do not
+            std::vector<std::string> units;
+            for (const auto& name : names) {
+                for (auto& unit : expand_braces(name)) units.push_back(std::move(unit));
+            }
+            std::vector<std::string> known_units;
+            std::string text;
+            for (const auto& name : units) {
+                bool known;
+                {
+                    std::lock_guard<std::mutex> lock(services_mutex);
+                    auto it = type == JobType::STOP ? services.find(name) : find_or_instantiate(name);
+                    known = it != services.end();
+                    if (known) {
+                        // An operator decision overrides any pending
+                        // restart and clears the crash-loop history
+                        Service& svc = it->second;
+                        svc.restart_seq++;
+                        svc.failures = 0;
+                        svc.recent_failures.clear();
+                        services_changed();
+                    }
+                }
+                if (!known) {
+                    text += "Service not found: " + name + "\n";
+                    continue;
+                }
+                known_units.push_back(name);
+            }
+            auto batch = enqueue_jobs(type, known_units);
+            
+            if (!block || batch.size() < units.size()) {
+                std::string ids;
+                for (const auto& job : batch) {
+                    ids += (ids.empty() ? "" : json ? "," : " ") + std::to_string(job->id);
+                }
+                if (json) text = "{\"jobs\":[" + ids + "]}\n";
+                else if (!batch.empty()) text += "Queued job " + ids + "\n";
+                conn->reply(id, text, batch.size() < units.size());
+                return;
             }
-            else if (cmd == "status") response = get_service_status(svc_name);
-            else if (cmd == "list") response = list_services();
-            else response = "Unknown command\n";
+            when_jobs_done(batch, [conn, id, json](bool ok) {
+                std::string text = json ? std::string("{\"ok\":") + (ok ? "true" : "false") + "}\n"
+                                        : (ok ? "OK\n" : "FAILED\n");
+                conn->reply(id, text, !ok);
+            });
+        }
+        else if (cmd == "jobs") conn->reply(id, list_jobs(json));
+        else if (cmd == "timers") conn->reply(id, list_timers(json));
+        else if (cmd == "reload") conn->reply(id, reload_services());
+        else if (cmd == "poweroff" || cmd == "reboot" || cmd == "halt") {
+            ShutdownAction action = cmd == "poweroff" ? ShutdownAction::POWEROFF :
+                                    cmd == "reboot" ? ShutdownAction::REBOOT : ShutdownAction::HALT;
+            // Test mode only stops the services and exits
+            if (getpid() != 1) action = ShutdownAction::EXIT;
+            if (begin_shutdown(action)) conn->reply(id, "OK\n");
+            else conn->reply(id, "Shutdown already in progress\n", true);
+        }
+        else if (cmd == "wait" && !names.empty()) {
+            auto batch = find_jobs(names);
+            if (batch.size() < names.size()) {
+                conn->reply(id, "Job not found\n", true);
+                return;
+            }
+            when_jobs_done(batch, [conn, id, json](bool ok) {
+                std::string text = json ? std::string("{\"ok\":") + (ok ? "true" : "false") + "}\n"
+                                        : (ok ? "OK\n" : "FAILED\n");
+                conn->reply(id, text, !ok);
+            });
+        }
+        else conn->reply(id, "Unknown command\n", true);
+    }
+
+    void setup_signals() {
+        signal_fd = signalfd(-1, &handled_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (signal_fd == -1) return;
+        loop.watch(signal_fd, EPOLLIN, [this](uint32_t) { handle_signals(); });
+    }
 
-            write(client, response.c_str(), response.length());
+    void handle_signals() {
+        struct signalfd_siginfo info;
+        bool child_exited = false;
+        while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+            if (info.ssi_signo == SIGCHLD) {
+                child_exited = true;
+            } else if (getpid() != 1) {
+                std::cout << "[AirRide] Caught signal " << info.ssi_signo << std::endl;
+                // A second signal gives up on stopping services
+                if (!begin_shutdown(ShutdownAction::EXIT)) running = false;
+            } else if (info.ssi_signo == SIGUSR1) {
+                begin_shutdown(ShutdownAction::HALT);
+            } else if (info.ssi_signo == SIGUSR2) {
+                begin_shutdown(ShutdownAction::POWEROFF);
+            } else {
+                // SIGTERM, or SIGINT from Ctrl-Alt-Del
+                begin_shutdown(ShutdownAction::REBOOT);
+            }
         }
-        close(client);
+        // SIGCHLD coalesces, so always drain every exited child
+        if (child_exited) reap_zombies();
     }
 
+    // Catch-all for SIGCHLD: services are normally collected through their
+    // pidfd, but orphans reparented to PID 1 only show up here
     void reap_zombies() {
         int status;
         pid_t pid;
         while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-            std::lock_guard<std::mutex> lock(services_mutex);
-            for (auto& [name, svc] : services) {
-                if (svc.pid == pid) {
-                    bool success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
-                    svc.state = success ? ServiceState::STOPPED : ServiceState::FAILED;
-                    svc.pid = 0;
-                    
-                    std::cout << "[AirRide] Service " << name << " exited" << std::endl;
-                    
-                    // Auto-restart if configured
-                    if (svc.restart_on_failure && svc.failures < 10) {
-                        svc.failures++;
-                        std::string svc_name = name;
-                        int delay = svc.restart_delay;
-                        std::thread([this, svc_name, delay]() {
-                            sleep(delay);
-                            start_service(svc_name);
-                        }).detach();
-                    }
-                    break;
+            handle_child_exit(pid, status);
+        }
+    }
+
+    // Watch a freshly forked service through a pidfd. Called with
+    // services_mutex held; kernels without pidfd fall back to SIGCHLD.
+    void track_pidfd(Service* svc, pid_t pid) {
+        int fd = pidfd_open(pid);
+        if (fd == -1) return;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        svc->pidfd = fd;
+        
+        loop.post([this, pid, fd]() {
+            loop.watch(fd, EPOLLIN, [this, pid, fd](uint32_t) {
+                siginfo_t info;
+                memset(&info, 0, sizeof(info));
+                // ECHILD: the SIGCHLD path already reaped it
+                if (waitid((idtype_t)P_PIDFD, fd, &info, WEXITED | WNOHANG) == 0 && info.si_pid == pid) {
+                    int status = info.si_code == CLD_EXITED ? (info.si_status & 0xff) << 8
+                                                            : (info.si_status & 0x7f);
+                    handle_child_exit(pid, status);
+                }
+                loop.unwatch(fd);
+                close(fd);
+            });
+        });
+    }
+
+    void handle_child_exit(pid_t pid, int status) {
+        std::lock_guard<std::mutex> lock(services_mutex);
+        auto idx = pid_index.find(pid);
+        if (idx == pid_index.end()) {
+            // Its starter has yet to publish the pid and picks this up
+            if (spawns_in_flight > 0) early_exits[pid] = status;
+            return;
+        }
+        Service& svc = *idx->second;
+        pid_index.erase(idx);
+        const std::string& name = svc.name;
+
+        bool success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        bool stopping = svc.state == ServiceState::STOPPING;
+        svc.state = success ? ServiceState::STOPPED : ServiceState::FAILED;
+        svc.pid = 0;
+        svc.pidfd = -1;
+        svc.timeline.exited = monotonic_us();
+        if (svc.type == ServiceType::ONESHOT && success) {
+            svc.timeline.ready = svc.timeline.exited;
+        }
+        services_changed();
+        
+        bool activated = has_sockets(name) && !shutting_down;
+        if (stopping && activated) arm_sockets(name);
+        
+        // Stops are reported by stop_service()
+        if (stopping) return;
+        if (svc.type == ServiceType::ONESHOT) {
+            if (success) {
+                std::cout << "[AirRide] " << name << " completed" << std::endl;
+                return;
+            }
+            std::cerr << "[AirRide] " << name << " failed" << std::endl;
+            // A oneshot that finished did its job; only failures are retried
+            if (svc.restart_on_failure) schedule_restart(svc);
+            return;
+        }
+        
+        std::cout << "[AirRide] Service " << name << " exited" << std::endl;
+        
+        if (activated && (success || !svc.restart_on_failure)) {
+            // Idle exit, or no restart policy: wait for the next connection
+            if (!success && crash_looping(svc)) return;
+            arm_sockets(name);
+        } else if (svc.restart_on_failure) {
+            schedule_restart(svc);
+        }
+    }
+
+    // Called with services_mutex held. Records a failure and reports
+    // whether the unit has failed too often inside its burst window.
+    bool crash_looping(Service& svc) {
+        int64_t now = monotonic_us();
+        int64_t window = (int64_t)svc.restart_interval * 1000000;
+        
+        // A run that outlived the window was healthy; start over
+        if (svc.timeline.forked && now - svc.timeline.forked >= window) svc.failures = 0;
+        
+        svc.recent_failures.push_back(now);
+        while (now - svc.recent_failures.front() > window) svc.recent_failures.pop_front();
+        if ((int)svc.recent_failures.size() <= svc.restart_burst) return false;
+        
+        std::cerr << "[AirRide] " << svc.name << " failed " << svc.recent_failures.size()
+                  << " times in " << svc.restart_interval << "s, not restarting" << std::endl;
+        svc.state = ServiceState::FAILED;
+        services_changed();
+        return true;
+    }
+
+    // Called with services_mutex held, on the loop thread. Restarts back
+    // off exponentially; a unit that keeps failing inside its burst window
+    // is left FAILED until someone starts it by hand.
+    void schedule_restart(Service& svc) {
+        if (crash_looping(svc)) return;
+        
+        double delay = svc.restart_delay * 1000.0 * std::pow(svc.restart_backoff, svc.failures);
+        delay = std::min(delay, svc.restart_max_delay * 1000.0);
+        if (svc.restart_jitter > 0) {
+            std::uniform_real_distribution<double> spread(-svc.restart_jitter / 100.0, svc.restart_jitter / 100.0);
+            delay += delay * spread(restart_rng);
+        }
+        svc.failures++;
+        
+        std::cout << "[AirRide] Restarting " << svc.name << " in " << format_us((int64_t)(delay * 1000)) << std::endl;
+        std::string name = svc.name;
+        uint64_t seq = ++svc.restart_seq;
+        loop.add_timer((int)delay, [this, name, seq]() {
+            {
+                std::lock_guard<std::mutex> lock(services_mutex);
+                auto it = services.find(name);
+                // Stopped or started by hand in the meantime
+                if (it == services.end() || it->second.restart_seq != seq) return;
+            }
+            enqueue_job(JobType::START, name);
+        });
+    }
+
+    // Called with services_mutex held
+    bool has_sockets(const std::string& service) {
+        for (const auto& [name, sock] : sockets) {
+            if (sock.service == service) return true;
+        }
+        return false;
+    }
+
+    bool bind_listener(const SocketUnit& sock, Listener& l) {
+        if (l.address[0] == '/') {
+            struct sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, l.address.c_str(), sizeof(addr.sun_path) - 1);
+            
+            l.fd = socket(AF_UNIX, l.type | SOCK_CLOEXEC, 0);
+            if (l.fd == -1) return false;
+            unlink(l.address.c_str());
+            if (bind(l.fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) return false;
+            chmod(l.address.c_str(), sock.mode);
+        } else {
+            // "port", "host:port" or "[v6 host]:port"
+            std::string host, port = l.address;
+            size_t colon = l.address.rfind(':');
+            if (colon != std::string::npos) {
+                host = l.address.substr(0, colon);
+                port = l.address.substr(colon + 1);
+                if (host.size() > 1 && host[0] == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+            }
+            
+            // Numeric addresses only: PID 1 must not depend on a resolver
+            struct sockaddr_storage addr;
+            memset(&addr, 0, sizeof(addr));
+            auto* v4 = (struct sockaddr_in*)&addr;
+            auto* v6 = (struct sockaddr_in6*)&addr;
+            char* end;
+            errno = 0;
+            unsigned long number = strtoul(port.c_str(), &end, 10);
+            if (port.empty() || !isdigit((unsigned char)port[0]) || *end != '\0' ||
+                errno == ERANGE || number < 1 || number > 65535) {
+                errno = EINVAL;
+                return false;
+            }
+            uint16_t portno = htons((uint16_t)number);
+            socklen_t len = sizeof(*v6);
+            if (host.empty()) {
+                v6->sin6_family = AF_INET6;
+                v6->sin6_addr = in6addr_any;
+                v6->sin6_port = portno;
+            } else if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+                v4->sin_family = AF_INET;
+                v4->sin_port = portno;
+                len = sizeof(*v4);
+            } else if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+                v6->sin6_family = AF_INET6;
+                v6->sin6_port = portno;
+            } else {
+                errno = EINVAL;
+                return false;
+            }
+            
+            l.fd = socket(addr.ss_family, l.type | SOCK_CLOEXEC, 0);
+            if (l.fd == -1 && host.empty() && errno == EAFNOSUPPORT) {
+                // No IPv6 in this kernel: plain IPv4 wildcard
+                memset(&addr, 0, sizeof(addr));
+                v4->sin_family = AF_INET;
+                v4->sin_addr.s_addr = htonl(INADDR_ANY);
+                v4->sin_port = portno;
+                len = sizeof(*v4);
+                l.fd = socket(AF_INET, l.type | SOCK_CLOEXEC, 0);
+            }
+            if (l.fd == -1) return false;
+            int one = 1, zero = 0;
+            setsockopt(l.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            // The wildcard takes IPv4 clients too
+            if (addr.ss_family == AF_INET6) setsockopt(l.fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+            if (bind(l.fd, (struct sockaddr*)&addr, len) == -1) return false;
+        }
+        return l.type != SOCK_STREAM || listen(l.fd, sock.backlog) == 0;
+    }
+
+    // Bind every .socket listener and start watching for the first client.
+    // Runs before any service starts, so dependents can connect at once.
+    void setup_sockets() {
+        std::lock_guard<std::mutex> lock(services_mutex);
+        for (auto& [name, sock] : sockets) {
+            for (auto& l : sock.listeners) {
+                if (!bind_listener(sock, l)) {
+                    std::cerr << "[AirRide] " << name << ": cannot listen on " << l.address
+                              << ": " << strerror(errno) << std::endl;
+                    if (l.fd != -1) close(l.fd);
+                    l.fd = -1;
                 }
             }
+            if (!services.count(sock.service)) {
+                std::cerr << "[AirRide] " << name << ": no service " << sock.service << std::endl;
+                continue;
+            }
+            arm_sockets(sock.service);
+        }
+    }
+
+    // Called with services_mutex held, on the event loop thread
+    void arm_sockets(const std::string& service) {
+        for (auto& [name, sock] : sockets) {
+            if (sock.service != service) continue;
+            for (auto& l : sock.listeners) {
+                if (l.fd == -1 || l.armed) continue;
+                std::string sname = name;
+                l.armed = loop.watch(l.fd, EPOLLIN, [this, sname, service](uint32_t) {
+                    {
+                        std::lock_guard<std::mutex> lock(services_mutex);
+                        disarm_sockets(service);
+                    }
+                    std::cout << "[AirRide] Activating " << service << " for " << sname << std::endl;
+                    // If the start merged into one already under way, the
+                    // exit that should re-arm us may already have happened
+                    when_jobs_done({enqueue_job(JobType::START, service)}, [this, service](bool) {
+                        loop.post([this, service]() {
+                            std::lock_guard<std::mutex> lock(services_mutex);
+                            auto it = services.find(service);
+                            if (it == services.end() || it->second.pid != 0) return;
+                            if ((int)it->second.recent_failures.size() > it->second.restart_burst) return;
+                            arm_sockets(service);
+                        });
+                    });
+                });
+            }
+        }
+    }
+
+    // Called with services_mutex held, on the event loop thread
+    void disarm_sockets(const std::string& service) {
+        for (auto& [name, sock] : sockets) {
+            if (sock.service != service) continue;
+            for (auto& l : sock.listeners) {
+                if (!l.armed) continue;
+                loop.unwatch(l.fd);
+                l.armed = false;
+            }
         }
     }
 
     void start_autostart_services() {
         std::cout << "[AirRide] Starting services..." << std::endl;
+        int64_t phase_start = monotonic_us();
         
-        std::vector<std::string> parallel_services;
-        std::vector<std::string> sequential_services;
-        std::vector<std::string> tty_services;
-        
+        std::vector<std::string> autostart;
+        bool have_tty = false;
         {
             std::lock_guard<std::mutex> lock(services_mutex);
             for (auto& [name, svc] : services) {
                 if (!svc.autostart) continue;
-                
-                // TTY services (like login prompts) start last
-                if (!svc.tty_device.empty() || svc.foreground) {
-                    tty_services.push_back(name);
-                } else if (svc.parallel) {
-                    parallel_services.push_back(name);
-                } else {
-                    sequential_services.push_back(name);
-                }
+                autostart.push_back(name);
+                if (!svc.tty_device.empty() || svc.foreground) have_tty = true;
             }
         }
         
-        // Start parallel services in threads
-        std::vector<std::thread> threads;
-        for (const auto& name : parallel_services) {
-            threads.emplace_back([this, name]() {
-                start_service_internal(name);
+        std::vector<bool> results;
+        start_services(autostart, true, &results);
+        record_phase("start-services", phase_start);
+        boot_done = true;
+        // Units held back by a failed dependency or a cycle count as failed
+        size_t failed = std::count(results.begin(), results.end(), false);
+        std::string summary = "[AirRide] Started " + std::to_string(autostart.size() - failed) + " services in " +
+                              format_us(monotonic_us() - phase_start);
+        if (failed) summary += ", " + std::to_string(failed) + " failed";
+        console.summary(summary);
+        if (record_readahead) {
+            loop.post([this]() {
+                loop.add_timer(READAHEAD_TAIL_MS, [this]() { finish_readahead_record(); });
             });
         }
         
-        // Start sequential services
-        for (const auto& name : sequential_services) {
-            start_service_internal(name);
-        }
-        
-        // Wait for all parallel services
-        for (auto& t : threads) {
-            if (t.joinable()) t.join();
-        }
-        
-        // Wait for network to settle
-        usleep(500000);
-        
-        // Clear screen before TTY services
-        clear_console();
-        
-        // Start TTY services (login prompts)
-        if (!tty_services.empty()) {
-            for (const auto& name : tty_services) {
-                start_service_internal(name);
-            }
-        } else {
+        if (!have_tty) {
+            clear_console();
             std::cout << "[AirRide] No TTY services, starting emergency shell" << std::endl;
             start_service("shell");
         }
@@ -581,38 +6668,93 @@ private:
 public:
     AirRide() {
         signal(SIGCHLD, SIG_DFL);
+        
+        // Block before any thread exists so every thread inherits the mask
+        // and these signals are only ever delivered through the signalfd
+        sigemptyset(&handled_signals);
+        sigaddset(&handled_signals, SIGCHLD);
+        sigaddset(&handled_signals, SIGTERM);
+        sigaddset(&handled_signals, SIGINT);
+        sigaddset(&handled_signals, SIGUSR1);
+        sigaddset(&handled_signals, SIGUSR2);
+        sigprocmask(SIG_BLOCK, &handled_signals, nullptr);
     }
 
     void run() {
+        init_started = monotonic_us();
         clear_console();
         std::cout << "=== AirRide Init System ===" << std::endl;
         std::cout << "[AirRide] PID " << getpid() << std::endl;
+        // Prefetching overlaps mounting and unit loading
+        record_readahead = setup_readahead();
 
         if (getpid() == 1) {
+            int64_t phase_start = monotonic_us();
             mount_filesystems();
+            record_phase("mount", phase_start);
+            setup_console();
+            // Ctrl-Alt-Del now arrives as SIGINT
+            reboot(RB_DISABLE_CAD);
         } else {
             std::cout << "[AirRide] Test mode" << std::endl;
+            setup_console();
         }
 
+        if (!loop.init()) {
+            std::cerr << "[AirRide] Failed to create event loop" << std::endl;
+            return;
+        }
+        setup_signals();
+        setup_devices();
+        if (record_readahead) start_readahead_record();
+        setup_cgroups();
+        mkdir(paths.logs.c_str(), 0755);
+        size_t journal_max = JOURNAL_MAX_BYTES;
+        if (!journal_max_option.empty() && !parse_size(journal_max_option, journal_max)) {
+            std::cerr << "[AirRide] Bad journal size: " << journal_max_option << std::endl;
+            journal_max = JOURNAL_MAX_BYTES;
+        }
+        if (!journal.open(paths.logs + "/journal", journal_max)) {
+            std::cerr << "[AirRide] Journal unavailable, logging to files only" << std::endl;
+        }
+        setup_start_slots();
+        job_pool.start(JOB_WORKERS);
         setup_control_socket();
+        int64_t phase_start = monotonic_us();
         load_services();
-        start_autostart_services();
+        record_phase("load-services", phase_start);
+        phase_start = monotonic_us();
+        setup_sockets();
+        record_phase("sockets", phase_start);
+        setup_timers();
+        setup_inotify();
+        
+        // Boot runs beside the loop so exits are reaped while services start
+        std::thread([this]() { start_autostart_services(); }).detach();
 
         while (running) {
-            handle_control_commands();
-            reap_zombies();
-            usleep(100000);
+            loop.run_once();
         }
+        journal.flush();
+        journal.wait_sealed();
 
         if (control_socket != -1) {
             close(control_socket);
-            unlink(AIRRIDE_SOCKET);
+            unlink(paths.socket.c_str());
         }
+        if (signal_fd != -1) close(signal_fd);
+        if (getpid() == 1) finish_shutdown();
+        else remove_cgroups();
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
+    configure(argc, argv);
+    console.start();
     AirRide init;
     init.run();
-    return 0;
+    // Detached workers may still be parked on our condition variables;
+    // leave without running destructors under them
+    console.drain(CONSOLE_DRAIN_MS);
+    _exit(0);
 }
@@ -0,0 +1,498 @@
+#!/bin/bash
+# Smoke test for AirRide in test mode (not PID 1).
+#
+# Boots a test-mode airride on unit files written to a scratch directory,
+# with its own socket, log, cache and state paths, and checks the outcome
+# through airridectl. Services get a cgroup of their own below ours when
+# cgroup2 is mounted, removed again on exit; nothing else outside the
+# scratch directory is touched, so it can run beside a live AirRide.
+#
+#   AirRide/smoke-test.sh [airride] [airridectl]
+#
+# Defaults to Init/build/airride and Ctl/build/airridectl next to this
+# script. Exits non-zero if any check fails.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+INIT="${1:-$SCRIPT_DIR/Init/build/airride}"
+CTL="${2:-$SCRIPT_DIR/Ctl/build/airridectl}"
+
+WORK="$(mktemp -d /tmp/airride-smoke.XXXXXX)"
+UNITS="$WORK/units"
+SOCK="$WORK/airride.sock"
+OUT="$WORK/airride.out"
+INIT_PID=""
+
+# Per-instance group below the cgroup we run in, if cgroup2 is mounted
+CGROUP=""
+CGROUP_MOUNT="$(awk '$3 == "cgroup2" { print $2; exit }' /proc/mounts)"
+if [[ -n "$CGROUP_MOUNT" ]]; then
+    CGROUP="$CGROUP_MOUNT$(sed -n 's/^0:://p' /proc/self/cgroup)"
+    CGROUP="${CGROUP%/}/airride-smoke-$$"
+fi
+
+# Colors
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+FAILURES=0
+
+print_check() {
+    if [[ $1 -eq 0 ]]; then
+        echo -e "${GREEN}✓${NC} $2"
+    else
+        echo -e "${RED}✗${NC} $2"
+        FAILURES=$((FAILURES + 1))
+    fi
+}
+
+cleanup() {
+    [[ -n "$INIT_PID" ]] && kill "$INIT_PID" 2>/dev/null && wait "$INIT_PID" 2>/dev/null
+    # airride removes its groups on a clean exit; this covers the rest
+    if [[ -n "$CGROUP" && -d "$CGROUP" ]]; then
+        for group in "$CGROUP"/*/; do
+            [[ -e "$group/cgroup.kill" ]] && echo 1 > "$group/cgroup.kill"
+        done
+        find "$CGROUP" -depth -type d -exec rmdir {} + 2>/dev/null
+    fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+ctl() {
+    "$CTL" --socket "$SOCK" "$@"
+}
+
+# unit <file> <lines...>: write a unit file, one argument per line
+unit() {
+    local file="$UNITS/$1"
+    shift
+    printf '%s\n' "$@" > "$file"
+}
+
+# State column of `list` for a unit: running, stopped, failed...
+state() {
+    ctl list | awk -v u="$1" '$1 == u { print $3 }'
+}
+
+# Start airride, with any extra flags given, and wait until boot has finished
+boot() {
+    : > "$OUT"
+    "$INIT" --socket "$SOCK" --services "$UNITS" --log-dir "$WORK/logs" \
+            --unit-cache "$WORK/units.cache" --timer-state "$WORK/timers.state" \
+            ${CGROUP:+--cgroup "$CGROUP"} --readahead off "$@" < /dev/null > "$OUT" 2>&1 &
+    INIT_PID=$!
+    for _ in $(seq 100); do
+        grep -qa "\] Started [0-9]* services" "$OUT" && return 0
+        kill -0 "$INIT_PID" 2>/dev/null || break
+        sleep 0.1
+    done
+    echo -e "${RED}airride did not finish booting:${NC}"
+    cat "$OUT"
+    return 1
+}
+
+# Shut the test instance down; fails if it does not exit cleanly
+poweroff() {
+    ctl poweroff > /dev/null
+    wait "$INIT_PID"
+    local status=$?
+    INIT_PID=""
+    return $status
+}
+
+if [[ ! -x "$INIT" || ! -x "$CTL" ]]; then
+    echo "Usage: $0 [airride] [airridectl]"
+    echo "Build Init and Ctl first; not found: $INIT $CTL"
+    exit 2
+fi
+
+echo "=== AirRide Smoke Test ==="
+echo ""
+
+# ---------------------------------------------------------------------------
+echo -e "${BLUE}[1] Start scheduling${NC}"
+mkdir -p "$UNITS"
+
+# ca and cb order after each other; hard requires the cycle, soft is
+# only ordered after it, sleeper is unrelated
+unit ca.service "[Service]" "name=ca" "exec_start=/bin/sleep 100" "autostart=true" \
+                "[Dependencies]" "after=cb"
+unit cb.service "[Service]" "name=cb" "exec_start=/bin/sleep 100" "autostart=true" \
+                "[Dependencies]" "after=ca"
+unit hard.service "[Service]" "name=hard" "exec_start=/bin/sleep 100" "autostart=true" \
+                  "[Dependencies]" "requires=ca"
+unit soft.service "[Service]" "name=soft" "exec_start=/bin/sleep 100" "autostart=true" \
+                  "[Dependencies]" "after=cb"
+unit sleeper.service "[Service]" "name=sleeper" "exec_start=/bin/sleep 100" "autostart=true"
+
+# A failing oneshot: a requires= dependent is held back, an after= one is not
+unit broken.service "[Service]" "name=broken" "type=oneshot" "exec_start=/bin/false" "autostart=true"
+unit needs.service "[Service]" "name=needs" "exec_start=/bin/sleep 100" "autostart=true" \
+                   "[Dependencies]" "requires=broken"
+unit orders.service "[Service]" "name=orders" "exec_start=/bin/sleep 100" "autostart=true" \
+                    "[Dependencies]" "after=broken"
+
+# after= waits for the predecessor: second only starts once first is done
+unit first.service "[Service]" "name=first" "type=oneshot" "autostart=true" \
+                   "exec_start=/bin/sh -c 'sleep 0.3; touch $WORK/first.done'"
+unit second.service "[Service]" "name=second" "type=oneshot" "autostart=true" \
+                    "exec_start=/bin/sh -c 'test -f $WORK/first.done'" \
+                    "[Dependencies]" "after=first"
+
+# A oneshot with a restart policy is retried when it fails: this one
+# fails the first time and succeeds the second
+unit retry.service "[Service]" "name=retry" "type=oneshot" "restart=on-failure" "restart_delay=0" \
+                   "exec_start=/bin/sh -c 'test -f $WORK/retry.once || { touch $WORK/retry.once; exit 1; }'"
+
+# A login prompt goes last at boot, but a unit ordered after it must not
+# turn that into a cycle
+unit getty.service "[Service]" "name=getty" "exec_start=/bin/sleep 100" "tty=/dev/null" "autostart=true"
+unit late.service "[Service]" "name=late" "exec_start=/bin/sleep 100" "autostart=true" \
+                  "[Dependencies]" "after=getty"
+
+if boot; then
+    grep -qa "Dependency cycle among: ca cb$" "$OUT"
+    print_check $? "Cycle reported with its members only"
+    [[ "$(state ca)" == failed && "$(state cb)" == failed ]]
+    print_check $? "Cycle members failed"
+    [[ "$(state sleeper)" == running ]]
+    print_check $? "Unit outside the cycle started"
+    [[ "$(state hard)" != running ]]
+    print_check $? "requires= dependent of the cycle held back"
+    [[ "$(state soft)" == running ]]
+    print_check $? "after= dependent of the cycle started"
+    [[ "$(state needs)" != running && "$(state orders)" == running ]]
+    print_check $? "Failed dependency: requires= held back, after= started"
+    [[ "$(state second)" == stopped ]] && ! grep -qa "second failed" "$OUT"
+    print_check $? "after= waited for the predecessor to finish"
+    [[ "$(state getty)" == running && "$(state late)" == running ]]
+    print_check $? "Unit ordered after a login prompt started"
+    [[ $(grep -ca "Dependency cycle" "$OUT") -eq 1 ]]
+    print_check $? "No cycle made up from login prompt ordering"
+    grep -qa "Started 7 services in .*, 5 failed" "$OUT"
+    print_check $? "Boot summary counts held-back units as failed"
+
+    ctl stop sleeper > /dev/null && [[ "$(state sleeper)" == stopped ]]
+    print_check $? "stop"
+    ctl start sleeper > /dev/null && [[ "$(state sleeper)" == running ]]
+    print_check $? "start"
+    ctl start retry > /dev/null
+    for _ in $(seq 50); do
+        grep -qa "retry completed" "$OUT" && break
+        sleep 0.1
+    done
+    grep -qa "Restarting retry" "$OUT" && [[ "$(state retry)" == stopped ]]
+    print_check $? "Failed oneshot restarted"
+    poweroff
+    print_check $? "poweroff exits cleanly"
+else
+    print_check 1 "Boot"
+fi
+
+echo ""
+
+# ---------------------------------------------------------------------------
+echo -e "${BLUE}[2] Unit cache${NC}"
+rm -f "$UNITS"/*
+unit alpha.service "[Service]" "name=alpha" "description=Alpha v1" "exec_start=/bin/sleep 100" "autostart=true"
+unit beta.service "[Service]" "name=beta" "exec_start=/bin/sleep 100" "autostart=true" \
+                  "[Dependencies]" "requires=alpha"
+
+loaded() {
+    grep -a "services loaded" "$OUT"
+}
+
+# boot_check <description> <expect cached: yes/no>
+boot_check() {
+    if ! boot; then
+        print_check 1 "$1"
+        return
+    fi
+    local cached=no
+    loaded | grep -q "(cached)" && cached=yes
+    [[ "$cached" == "$2" && "$(state alpha)" == running && "$(state beta)" == running ]]
+    print_check $? "$1"
+}
+
+boot_check "First boot parses the unit files" no
+poweroff > /dev/null
+boot_check "Second boot loads from the cache" yes
+ctl status alpha | grep -q "Alpha v1"
+print_check $? "Cached definition matches the unit file"
+poweroff > /dev/null
+
+sed -i 's/Alpha v1/Alpha v2/' "$UNITS/alpha.service"
+boot_check "Edited unit file invalidates the cache" no
+ctl status alpha | grep -q "Alpha v2"
+print_check $? "Edited definition is used"
+poweroff > /dev/null
+
+unit gamma.service "[Service]" "name=gamma" "exec_start=/bin/sleep 100"
+boot_check "New unit file invalidates the cache" no
+[[ -n "$(state gamma)" ]]
+print_check $? "New unit is loaded"
+poweroff > /dev/null
+
+size=$(stat -c %s "$WORK/units.cache")
+printf '\xa5' | dd of="$WORK/units.cache" bs=1 seek=$((size / 2)) conv=notrunc status=none
+boot_check "Corrupted cache is rejected" no
+poweroff > /dev/null
+
+truncate -s $((size / 3)) "$WORK/units.cache"
+boot_check "Truncated cache is rejected" no
+poweroff > /dev/null
+
+head -c 4096 /dev/urandom > "$WORK/units.cache"
+boot_check "Garbage cache is rejected" no
+poweroff
+print_check $? "poweroff exits cleanly"
+
+echo ""
+
+# ---------------------------------------------------------------------------
+echo -e "${BLUE}[3] Control protocol framing${NC}"
+
+# Raw frames, which airridectl never sends: prints "ok|fail <check>" lines
+framing_checks() {
+    python3 - "$SOCK" <<'EOF'
+import socket, struct, sys, time
+
+HDR = struct.Struct("<2sBBHHII")   # magic, version, type, flags, reserved, id, length
+REQUEST, DATA, END, FAILED = 1, 2, 3, 0x1
+path = sys.argv[1]
+
+def connect():
+    s = socket.socket(socket.AF_UNIX)
+    s.settimeout(5)
+    s.connect(path)
+    return s
+
+def frame(cmd, id, version=2, magic=b"AR", length=None):
+    cmd = cmd.encode()
+    return HDR.pack(magic, version, REQUEST, 0, 0, id, len(cmd) if length is None else length) + cmd
+
+def read_replies(s, count):
+    """{id: (text, failed)} for the first `count` END frames"""
+    buf, text, done = b"", {}, {}
+    while len(done) < count:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        buf += chunk
+        while len(buf) >= HDR.size:
+            magic, version, type, flags, _, id, length = HDR.unpack_from(buf)
+            if len(buf) < HDR.size + length:
+                break
+            payload = buf[HDR.size:HDR.size + length]
+            buf = buf[HDR.size + length:]
+            if type == DATA:
+                text[id] = text.get(id, b"") + payload
+            elif type == END:
+                done[id] = (text.get(id, b"").decode(), bool(flags & FAILED))
+    return done
+
+def closed(s):
+    try:
+        return s.recv(1) == b""
+    except ConnectionResetError:
+        return True
+    except socket.timeout:
+        return False
+
+def alive():
+    s = connect()
+    s.sendall(frame("ping", 1))
+    return read_replies(s, 1).get(1, ("", True))[0] == "pong\n"
+
+def check(ok, desc):
+    print(("ok " if ok else "fail ") + desc)
+
+# Pipelined requests on one connection, answered by id
+s = connect()
+s.sendall(frame("ping", 7) + frame("list", 9) + frame("status nosuch", 11))
+r = read_replies(s, 3)
+check(r.get(7) == ("pong\n", False) and "alpha" in r.get(9, ("", True))[0] and r.get(11, ("", False))[1],
+      "Pipelined requests answered by id")
+
+# A request split across writes, header included
+s.sendall(frame("ping", 12)[:5])
+time.sleep(0.1)
+s.sendall(frame("ping", 12)[5:])
+check(read_replies(s, 1).get(12) == ("pong\n", False), "Request split across writes")
+
+# Unsupported version: failed reply, connection kept
+s.sendall(frame("ping", 13, version=99) + frame("ping", 14))
+r = read_replies(s, 2)
+check(r.get(13, ("", False))[1] and r.get(14) == ("pong\n", False), "Unsupported version refused")
+s.close()
+
+# Bad magic and oversized frames drop the connection, not init
+s = connect()
+s.sendall(frame("ping", 1) + frame("ping", 2, magic=b"XX"))
+check(read_replies(s, 1).get(1) == ("pong\n", False) and closed(s) and alive(), "Bad magic drops the connection")
+s = connect()
+s.sendall(frame("", 3, length=64 << 20))
+check(closed(s) and alive(), "Oversized request drops the connection")
+
+# Pre-framing clients send a bare command line
+s = connect()
+s.sendall(b"ping\n")
+check(b"pong" in s.recv(4096), "Unframed command")
+EOF
+}
+
+if ! command -v python3 > /dev/null; then
+    echo "python3 not found, skipping"
+elif boot; then
+    while read -r result desc; do
+        [[ "$result" == ok ]]
+        print_check $? "$desc"
+    done < <(framing_checks 2>&1)
+    ctl status nosuch > /dev/null 2>&1
+    [[ $? -eq 1 ]]
+    print_check $? "Failed command sets airridectl's exit status"
+    poweroff
+    print_check $? "poweroff exits cleanly"
+else
+    print_check 1 "Boot"
+fi
+
+echo ""
+
+# ---------------------------------------------------------------------------
+echo -e "${BLUE}[4] Journal${NC}"
+rm -f "$UNITS"/*
+JOURNAL="$WORK/logs/journal"
+
+# About 26 MB of records: three full segments get sealed, the rest stays
+# in the active one. quiet and late are found through the service and
+# time indexes among them.
+cat > "$WORK/chatty.sh" <<'EOF'
+#!/bin/sh
+echo chatty-first
+yes "$(printf '%0240d' 0)" | head -n 100000
+echo chatty-last
+EOF
+chmod +x "$WORK/chatty.sh"
+unit chatty.service "[Service]" "name=chatty" "type=oneshot" "exec_start=$WORK/chatty.sh"
+unit quiet.service "[Service]" "name=quiet" "type=oneshot" "exec_start=/bin/echo quiet-line"
+unit late.service "[Service]" "name=late" "type=oneshot" "exec_start=/bin/echo late-line"
+
+# lines <logs args...>: number of journal lines a query returns
+lines() {
+    ctl logs "$@" | grep -c .
+}
+
+before=$(( $(date +%s) - 1 ))
+if boot; then
+    ctl start chatty > /dev/null && ctl start quiet > /dev/null
+    mark=$(( $(date +%s) + 1 ))
+    sleep 1.2
+    ctl start late > /dev/null
+
+    (( $(ls "$JOURNAL" | grep -c '\.jnl') >= 4 ))
+    print_check $? "Full segments are sealed and a new one started"
+    [[ $(lines --service chatty) -eq 100002 ]]
+    print_check $? "Every record is found across segments"
+    ctl logs --service chatty | sed -n '1p;$p' | tr '\n' ' ' | grep -q "chatty-first.*chatty-last"
+    print_check $? "Records come back in order"
+    [[ $(lines --service quiet) -eq 1 ]] && ctl logs --service quiet | grep -q quiet-line
+    print_check $? "Service index finds a single record"
+    [[ $(lines --since @$mark) -eq 1 ]] && ctl logs --since @$mark | grep -q late-line
+    print_check $? "--since skips older blocks"
+    [[ $(lines --until @$before) -eq 0 ]]
+    print_check $? "--until before the first record finds nothing"
+    poweroff > /dev/null
+
+    # Not segments: strtoull alone reads these as 1, 1 and 16
+    for name in 0x00000000000001.jnl +000000000000001.jnl " 000000000000010.jnl"; do
+        echo junk > "$JOURNAL/$name"
+    done
+    echo junk > "$JOURNAL/00000000000000ff.jnl.zst.tmp"
+    boot
+    [[ $(lines --service chatty) -eq 100002 && $(lines --service late) -eq 1 ]]
+    print_check $? "Records survive a restart"
+    [[ -f "$JOURNAL/0x00000000000001.jnl" && -f "$JOURNAL/+000000000000001.jnl" &&
+       -f "$JOURNAL/ 000000000000010.jnl" ]]
+    print_check $? "Files that are not segments are left alone"
+    [[ ! -e "$JOURNAL/00000000000000ff.jnl.zst.tmp" ]]
+    print_check $? "Leftover seal output is removed"
+    poweroff > /dev/null
+
+    boot --journal-max 1M
+    chatty=$(lines --service chatty)
+    (( chatty > 0 && chatty < 100002 )) && [[ $(lines --service late) -eq 1 ]]
+    print_check $? "--journal-max drops the oldest segments"
+    poweroff
+    print_check $? "poweroff exits cleanly"
+else
+    print_check 1 "Boot"
+fi
+
+echo ""
+
+# ---------------------------------------------------------------------------
+echo -e "${BLUE}[5] Calendar timers${NC}"
+rm -f "$UNITS"/*
+unit tick.service "[Service]" "name=tick" "type=oneshot" "exec_start=/bin/true"
+
+# timer <name> <on_calendar>
+timer() {
+    unit "$1.timer" "[Timer]" "name=$1" "service=tick" "on_calendar=$2"
+}
+
+# Elapses are searched for five years ahead
+year=$(date +%Y)
+timer fixed "$((year + 2))-02-03 04:05:06"
+timer ranges "$((year + 1))..$((year + 3))-1,6-1..3 4/2:05:06"
+timer daily "daily"
+timer weekdays "Mon..Fri *-*-* 10:30"
+# Junk that atoi used to read as a number
+timer trailing "*-*-* 5x:00"
+timer zero-step "*-*-* */0:00"
+timer junk-step "*-*-* */2x:00"
+timer junk-from "*-*-* 3x..5:00"
+timer junk-to "*-*-* 3..5x:00"
+timer signed "*-*-* 1..+5:00"
+timer bad-year "$((year + 1))x-01-01"
+
+# Next elapse of a timer as shown by `timers`: "YYYY-MM-DD HH:MM:SS"
+next_elapse() {
+    ctl timers | awk -v t="$1.timer" 'NF > 3 && $(NF - 2) == t { print $1, $2 }'
+}
+
+if boot; then
+    [[ "$(next_elapse fixed)" == "$((year + 2))-02-03 04:05:06" ]]
+    print_check $? "Fixed date and time"
+    [[ "$(next_elapse ranges)" == "$((year + 1))-01-01 04:05:06" ]]
+    print_check $? "Year range, day range and hour step"
+    [[ "$(next_elapse daily)" == *" 00:00:00" ]]
+    print_check $? "Shorthand"
+    [[ "$(next_elapse weekdays)" == *" 10:30:00" ]]
+    print_check $? "Weekday range"
+    for name in trailing zero-step junk-step junk-from junk-to signed bad-year; do
+        [[ -z "$(next_elapse $name)" ]] && grep -qa "$name.timer: bad on_calendar" "$OUT"
+        print_check $? "Rejected: $(grep -a '^on_calendar=' "$UNITS/$name.timer" | cut -d= -f2-)"
+    done
+    poweroff
+    print_check $? "poweroff exits cleanly"
+else
+    print_check 1 "Boot"
+fi
+
+if [[ -n "$CGROUP" ]]; then
+    [[ ! -d "$CGROUP" ]]
+    print_check $? "Service cgroups removed on exit"
+fi
+
+echo ""
+if [[ $FAILURES -eq 0 ]]; then
+    echo -e "${GREEN}All checks passed${NC}"
+else
+    echo -e "${RED}$FAILURES check(s) failed${NC}"
+    echo "--- airride output ---"
+    cat "$OUT"
+fi
+exit $((FAILURES > 0))
@@ -375,7 +375,7 @@ build_airride() {
     print_step 3 11 "Build AirRide Init"
     cd "$AIRRIDE_DIR/Init"
     mkdir -p build
-    g++ -o build/airride src/main.cpp -Wall -Wextra -O2 -std=c++17 -fstack-protector-strong || return 1
+    g++ -o build/airride src/main.cpp -Wall -Wextra -O2 -std=c++17 -fstack-protector-strong -DAIRRIDE_ZSTD -lzstd || return 1
     print_success "AirRide built"
     cd ../..
 }